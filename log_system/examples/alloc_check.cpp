@@ -0,0 +1,73 @@
+/* ************************************************************************
+> File Name:     alloc_check.cpp
+> Description:   统计稳定状态下每条日志的堆分配次数，期望为0
+>                预热后写入一批日志，期间所有线程的malloc/operator new都计数，
+>                分配次数不为0时返回1
+ ************************************************************************/
+#include "../logs_code/MyLog.hpp"
+#include "../logs_code/ThreadPoll.hpp"
+#include "../logs_code/Util.hpp"
+
+#include <atomic>
+#include <new>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static std::atomic<size_t> g_allocs(0);
+
+extern "C" void *malloc(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t n, size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+extern "C" void *realloc(void *ptr, size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+// operator new默认也会走malloc，这里显式替换，保证不同标准库实现下都能计数。
+// new/delete成对直接使用__libc_malloc/__libc_free，编译器不会把它们当成不匹配的malloc/free
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = __libc_malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { __libc_free(p); }
+void operator delete(void *p, size_t) noexcept { __libc_free(p); }
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+int main() {
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    tp = new ThreadPool(g_conf_data->thread_count);
+    std::shared_ptr<mylog::LoggerBuilder> Glb(new mylog::LoggerBuilder());
+    Glb->BuildLoggerName("alloc_check");
+    Glb->BuildLoggerFlush<mylog::FileFlush>("./logfile/alloc_check.log");
+    auto logger = Glb->Build();
+
+    const size_t warmup = 1000, records = 100000;
+    for (size_t i = 0; i < warmup; ++i)
+        logger->Info("warmup %zu %s", i, "payload");
+    usleep(100000); // 等异步线程完成首次写文件
+
+    size_t before = g_allocs.load();
+    for (size_t i = 0; i < records; ++i) {
+        logger->Info("steady %zu %s %d", i, "payload", 42);
+        logger->Warn("steady warn %zu", i);
+    }
+    size_t allocs = g_allocs.load() - before;
+
+    std::cout << "records: " << records * 2 << ", allocations: " << allocs
+              << ", per record: " << (double)allocs / (records * 2) << std::endl;
+    logger.reset();
+    delete (tp);
+    return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/* ************************************************************************
+> File Name:     bench.cpp
+> Description:   多线程日志吞吐量与生产者延迟基准测试
+>                按 线程数 x 消息大小 x AsyncType x 落地方式 x flush_log 组合运行，
+>                结果以JSON输出，便于跨版本对比回归
+> Usage:         ./bench [--threads 1,2,4] [--sizes 64,256] [--types safe,unsafe]
+>                        [--sinks stdout,file,roll] [--flush 0,1,2]
+>                        [--messages N] [--out result.json]
+ ************************************************************************/
+#include "../logs_code/MyLog.hpp"
+#include "../logs_code/ThreadPoll.hpp"
+#include "../logs_code/Util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::vector<size_t> threads = {1, 2, 4, 8, 16, 32, 64};
+        std::vector<size_t> sizes = {64, 256, 1024};
+        std::vector<std::string> types = {"safe", "unsafe"};
+        std::vector<std::string> sinks = {"stdout", "file", "roll"};
+        std::vector<size_t> flush = {0, 1, 2};
+        size_t messages = 100000; // 每组合写入的日志总条数，平均分给各线程
+        std::string out;          // 为空则输出到标准输出
+    };
+
+    struct Result {
+        double producer_secs; // 所有生产者完成Push的耗时
+        double total_secs;    // 包含异步线程把数据全部落地的耗时
+        int64_t p50, p99, p999, max; // 单次调用延迟，纳秒
+    };
+
+    static std::vector<std::string> Split(const std::string &s) {
+        std::vector<std::string> ret;
+        std::stringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            if (!item.empty())
+                ret.push_back(item);
+        return ret;
+    }
+
+    static std::vector<size_t> SplitNum(const std::string &s) {
+        std::vector<size_t> ret;
+        for (auto &e : Split(s))
+            ret.push_back(std::strtoull(e.c_str(), nullptr, 10));
+        return ret;
+    }
+
+    static bool ParseArgs(int argc, char *argv[], Options *opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string key = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << key << std::endl;
+                return false;
+            }
+            std::string val = argv[++i];
+            if (key == "--threads") opt->threads = SplitNum(val);
+            else if (key == "--sizes") opt->sizes = SplitNum(val);
+            else if (key == "--types") opt->types = Split(val);
+            else if (key == "--sinks") opt->sinks = Split(val);
+            else if (key == "--flush") opt->flush = SplitNum(val);
+            else if (key == "--messages") opt->messages = std::strtoull(val.c_str(), nullptr, 10);
+            else if (key == "--out") opt->out = val;
+            else {
+                std::cerr << "unknown option " << key << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static int64_t Percentile(const std::vector<int64_t> &sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        size_t idx = static_cast<size_t>(p * (sorted.size() - 1));
+        return sorted[idx];
+    }
+
+    static mylog::AsyncLogger::ptr BuildLogger(const std::string &name, const std::string &sink,
+                                               mylog::AsyncType type) {
+        mylog::LoggerBuilder builder;
+        builder.BuildLoggerName(name);
+        builder.BuildLoggerType(type);
+        if (sink == "file")
+            builder.BuildLoggerFlush<mylog::FileFlush>("./benchlog/" + name + ".log");
+        else if (sink == "roll")
+            builder.BuildLoggerFlush<mylog::RollFileFlush>("./benchlog/" + name + "-", 64 * 1024 * 1024);
+        else
+            builder.BuildLoggerFlush<mylog::StdoutFlush>();
+        return builder.Build();
+    }
+
+    static Result RunOne(size_t threads, size_t msg_size, mylog::AsyncType type,
+                         const std::string &sink, size_t messages, const std::string &name) {
+        std::string payload(msg_size, 'x');
+        size_t per_thread = std::max<size_t>(1, messages / threads);
+        std::vector<std::vector<int64_t>> lat(threads);
+        for (auto &v : lat)
+            v.reserve(per_thread);
+
+        auto logger = BuildLogger(name, sink, type);
+        Clock::time_point begin = Clock::now();
+        std::vector<std::thread> producers;
+        for (size_t t = 0; t < threads; ++t) {
+            producers.emplace_back([&, t]() {
+                for (size_t i = 0; i < per_thread; ++i) {
+                    Clock::time_point s = Clock::now();
+                    logger->Info("%s", payload.c_str());
+                    lat[t].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - s).count());
+                }
+            });
+        }
+        for (auto &th : producers)
+            th.join();
+        Clock::time_point produced = Clock::now();
+        logger.reset(); // 析构时异步线程会把剩余数据全部落地，再关闭日志文件写出stdio缓冲
+        Clock::time_point drained = Clock::now();
+
+        std::vector<int64_t> all;
+        all.reserve(per_thread * threads);
+        for (auto &v : lat)
+            all.insert(all.end(), v.begin(), v.end());
+        std::sort(all.begin(), all.end());
+
+        Result r;
+        r.producer_secs = std::chrono::duration<double>(produced - begin).count();
+        r.total_secs = std::chrono::duration<double>(drained - begin).count();
+        r.p50 = Percentile(all, 0.50);
+        r.p99 = Percentile(all, 0.99);
+        r.p999 = Percentile(all, 0.999);
+        r.max = all.empty() ? 0 : all.back();
+        return r;
+    }
+} // namespace bench
+
+int main(int argc, char *argv[]) {
+    bench::Options opt;
+    if (!bench::ParseArgs(argc, argv, &opt))
+        return 1;
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    tp = new ThreadPool(g_conf_data->thread_count);
+    mylog::Util::File::CreateDirectory("./benchlog/");
+
+    // StdoutFlush的数据丢到/dev/null，避免终端输出成为瓶颈
+    std::ofstream devnull("/dev/null");
+    std::streambuf *cout_buf = std::cout.rdbuf();
+
+    Json::Value root;
+    root["messages"] = (Json::UInt64)opt.messages;
+    root["buffer_size"] = (Json::UInt64)g_conf_data->buffer_size;
+    Json::Value &runs = root["runs"];
+    runs = Json::Value(Json::arrayValue);
+    size_t seq = 0;
+    for (size_t flush : opt.flush)
+        for (auto &sink : opt.sinks)
+            for (auto &type_name : opt.types)
+                for (size_t size : opt.sizes)
+                    for (size_t threads : opt.threads) {
+                        if (threads == 0)
+                            continue;
+                        g_conf_data->flush_log = flush;
+                        mylog::AsyncType type = type_name == "unsafe" ? mylog::AsyncType::ASYNC_UNSAFE
+                                                                      : mylog::AsyncType::ASYNC_SAFE;
+                        std::string name = "bench_" + std::to_string(seq++);
+                        if (sink == "stdout")
+                            std::cout.rdbuf(devnull.rdbuf());
+                        bench::Result r = bench::RunOne(threads, size, type, sink, opt.messages, name);
+                        std::cout.rdbuf(cout_buf);
+
+                        size_t total = std::max<size_t>(1, opt.messages / threads) * threads;
+                        Json::Value item;
+                        item["threads"] = (Json::UInt64)threads;
+                        item["msg_size"] = (Json::UInt64)size;
+                        item["async_type"] = type_name;
+                        item["sink"] = sink;
+                        item["flush_log"] = (Json::UInt64)flush;
+                        item["messages"] = (Json::UInt64)total;
+                        item["producer_secs"] = r.producer_secs;
+                        item["total_secs"] = r.total_secs;
+                        item["producer_msgs_per_sec"] = total / r.producer_secs;
+                        item["total_msgs_per_sec"] = total / r.total_secs;
+                        item["latency_ns_p50"] = (Json::Int64)r.p50;
+                        item["latency_ns_p99"] = (Json::Int64)r.p99;
+                        item["latency_ns_p999"] = (Json::Int64)r.p999;
+                        item["latency_ns_max"] = (Json::Int64)r.max;
+                        runs.append(item);
+                        std::cerr << "done " << name << " threads=" << threads << " size=" << size
+                                  << " type=" << type_name << " sink=" << sink << " flush=" << flush << std::endl;
+                    }
+
+    std::string body;
+    mylog::Util::JsonUtil::Serialize(root, &body);
+    if (opt.out.empty()) {
+        std::cout << body << std::endl;
+    } else {
+        std::ofstream ofs(opt.out);
+        ofs << body << std::endl;
+    }
+    delete (tp);
+    return 0;
+}
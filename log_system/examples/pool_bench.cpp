@@ -0,0 +1,245 @@
+/* ************************************************************************
+> File Name:     pool_bench.cpp
+> Description:   ThreadPool与WorkStealingPool的任务调度开销对比
+>                external：submitters个外部线程(类似reactor)提交小任务，
+>                          等全部执行完，统计吞吐和每个任务的堆分配次数
+>                fanout：  工作线程内递归提交子任务(二叉树)，考察本地队列和窃取
+>                每个任务只做很少的计算，测的是池本身的开销，结果以JSON输出
+> Usage:         ./pool_bench [--threads 1,2,4] [--submitters 1,2] [--tasks N]
+>                             [--depth D] [--work N] [--out result.json]
+ ************************************************************************/
+#include "../logs_code/MyLog.hpp"
+#include "../logs_code/ThreadPoll.hpp"
+#include "../logs_code/Util.hpp"
+#include "../logs_code/WorkStealingPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <vector>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+// 统计operator new的次数，看稳定后提交任务是否还分配内存
+static std::atomic<size_t> g_allocs(0);
+void *operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::vector<size_t> threads = {1, 2, 4, 8};
+        std::vector<size_t> submitters = {1, 4};
+        size_t tasks = 1000000; // external每组合的任务总数，平均分给各提交线程
+        size_t depth = 18;      // fanout的树高，共2^depth-1个任务
+        size_t work = 50;       // 每个任务的计算量
+        std::string out;        // 为空则输出到标准输出
+    };
+
+    struct Result {
+        double secs;
+        double tasks_per_sec;
+        double allocs_per_task;
+    };
+
+    static std::vector<size_t> SplitNum(const std::string &s) {
+        std::vector<size_t> ret;
+        std::stringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            if (!item.empty())
+                ret.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        return ret;
+    }
+
+    static bool ParseArgs(int argc, char *argv[], Options *opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string key = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << key << std::endl;
+                return false;
+            }
+            std::string val = argv[++i];
+            if (key == "--threads") opt->threads = SplitNum(val);
+            else if (key == "--submitters") opt->submitters = SplitNum(val);
+            else if (key == "--tasks") opt->tasks = std::strtoull(val.c_str(), nullptr, 10);
+            else if (key == "--depth") opt->depth = std::strtoull(val.c_str(), nullptr, 10);
+            else if (key == "--work") opt->work = std::strtoull(val.c_str(), nullptr, 10);
+            else if (key == "--out") opt->out = val;
+            else {
+                std::cerr << "unknown option " << key << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static std::atomic<uint64_t> g_sink(0);
+    static void Work(size_t n) {
+        uint64_t x = n;
+        for (size_t i = 0; i < n; ++i)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        g_sink.fetch_add(x & 1, std::memory_order_relaxed);
+    }
+
+    static void WaitDone(const std::atomic<size_t> &done, size_t n) {
+        while (done.load(std::memory_order_acquire) < n)
+            usleep(100);
+    }
+
+    // 两种池提交不关心返回值的任务：ThreadPool和AsyncTask原来的用法一样丢弃future
+    static void Submit(ThreadPool &pool, std::function<void()> f) {
+        pool.enqueue_to(ThreadPool::Priority::NORMAL, std::move(f));
+    }
+    template <class F>
+    static void Submit(WorkStealingPool &pool, F &&f) {
+        pool.submit(std::forward<F>(f));
+    }
+
+    template <class Pool>
+    static Result External(Pool &pool, size_t submitters, const Options &opt) {
+        size_t per = std::max<size_t>(1, opt.tasks / submitters);
+        size_t total = per * submitters;
+        std::atomic<size_t> done(0);
+        size_t work = opt.work;
+        auto run = [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                Submit(pool, [&done, work]() {
+                    Work(work);
+                    done.fetch_add(1, std::memory_order_release);
+                });
+        };
+        // 预热：让节点缓存、队列容量等达到稳定状态
+        run(std::min<size_t>(per, 10000));
+        WaitDone(done, std::min<size_t>(per, 10000));
+        done = 0;
+
+        size_t allocs = g_allocs.load();
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < submitters; ++t)
+            threads.emplace_back(run, per);
+        for (auto &th : threads)
+            th.join();
+        WaitDone(done, total);
+        Result r;
+        r.secs = std::chrono::duration<double>(Clock::now() - start).count();
+        r.tasks_per_sec = total / r.secs;
+        r.allocs_per_task = (double)(g_allocs.load() - allocs) / total;
+        return r;
+    }
+
+    template <class Pool>
+    struct Fanout {
+        Pool &pool;
+        std::atomic<size_t> &done;
+        size_t work;
+        void Spawn(size_t depth) {
+            Fanout *self = this;
+            Submit(pool, [self, depth]() { self->Run(depth); });
+        }
+        void Run(size_t depth) {
+            Work(work);
+            if (depth > 1) {
+                Spawn(depth - 1);
+                Spawn(depth - 1);
+            }
+            done.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    template <class Pool>
+    static Result FanoutRun(Pool &pool, const Options &opt) {
+        size_t total = (size_t(1) << opt.depth) - 1;
+        std::atomic<size_t> done(0);
+        Fanout<Pool> f{pool, done, opt.work};
+        size_t allocs = g_allocs.load();
+        auto start = Clock::now();
+        f.Spawn(opt.depth);
+        WaitDone(done, total);
+        Result r;
+        r.secs = std::chrono::duration<double>(Clock::now() - start).count();
+        r.tasks_per_sec = total / r.secs;
+        r.allocs_per_task = (double)(g_allocs.load() - allocs) / total;
+        return r;
+    }
+
+    static Json::Value ToJson(const Result &r) {
+        Json::Value item;
+        item["secs"] = r.secs;
+        item["tasks_per_sec"] = r.tasks_per_sec;
+        item["allocs_per_task"] = r.allocs_per_task;
+        return item;
+    }
+} // namespace bench
+
+int main(int argc, char *argv[]) {
+    bench::Options opt;
+    if (!bench::ParseArgs(argc, argv, &opt))
+        return 1;
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+
+    Json::Value root;
+    root["tasks"] = (Json::UInt64)opt.tasks;
+    root["depth"] = (Json::UInt64)opt.depth;
+    root["work"] = (Json::UInt64)opt.work;
+    root["cpus"] = std::thread::hardware_concurrency();
+    Json::Value &runs = root["runs"];
+    runs = Json::Value(Json::arrayValue);
+    for (size_t threads : opt.threads) {
+        if (threads == 0)
+            continue;
+        for (size_t submitters : opt.submitters) {
+            if (submitters == 0)
+                continue;
+            Json::Value item;
+            item["case"] = "external";
+            item["threads"] = (Json::UInt64)threads;
+            item["submitters"] = (Json::UInt64)submitters;
+            {
+                ThreadPool pool(threads);
+                item["thread_pool"] = bench::ToJson(bench::External(pool, submitters, opt));
+            }
+            {
+                WorkStealingPool pool(threads);
+                item["work_stealing"] = bench::ToJson(bench::External(pool, submitters, opt));
+            }
+            runs.append(item);
+            std::cerr << "done external threads=" << threads << " submitters=" << submitters << std::endl;
+        }
+        Json::Value item;
+        item["case"] = "fanout";
+        item["threads"] = (Json::UInt64)threads;
+        {
+            ThreadPool pool(threads);
+            item["thread_pool"] = bench::ToJson(bench::FanoutRun(pool, opt));
+        }
+        {
+            WorkStealingPool pool(threads);
+            item["work_stealing"] = bench::ToJson(bench::FanoutRun(pool, opt));
+        }
+        runs.append(item);
+        std::cerr << "done fanout threads=" << threads << std::endl;
+    }
+
+    std::string body;
+    mylog::Util::JsonUtil::Serialize(root, &body);
+    if (opt.out.empty()) {
+        std::cout << body << std::endl;
+    } else {
+        std::ofstream ofs(opt.out);
+        ofs << body << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+/* ************************************************************************
+> File Name:     shm_ring_check.cpp
+> Description:   共享内存日志环的多进程故障恢复检查
+>                1. 写日志进程被杀：环满后阻塞写入在等待上限内返回false，
+>                   重启写日志进程后日志恢复写入，且不会收到残缺的日志
+>                2. 生产者进程写到一半被杀：写日志进程跳过它留下的槽位，
+>                   之后其他生产者的日志都能完整收到
+>                每条日志跨3个槽位，收到的每条都检查是否完整，任一检查失败返回1
+ ************************************************************************/
+#include "../logs_code/MyLog.hpp"
+#include "../logs_code/ShmRing.hpp"
+#include "../logs_code/Util.hpp"
+
+#include <sys/wait.h>
+
+#include <map>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+static const char *kName = "/mylog_ring_check";
+static const size_t kSlots = 64;
+static const size_t kRecordLen = 600; // 3个槽位
+static const int64_t kWaitMs = 500;
+static const int64_t kStaleMs = 100;
+
+static int64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// "tag seq "后面补'x'到kRecordLen，以换行结尾
+static std::string Record(const std::string &tag, size_t seq) {
+    std::string s = tag + " " + std::to_string(seq) + " ";
+    s.resize(kRecordLen - 1, 'x');
+    s.push_back('\n');
+    return s;
+}
+
+static bool Push(mylog::ShmRing &ring, const std::string &tag, size_t seq) {
+    std::string s = Record(tag, seq);
+    return ring.Push(s.data(), s.size(), true, kWaitMs);
+}
+
+// 检查一批日志都完整，按tag统计条数
+static bool Check(const std::string &batch, std::map<std::string, size_t> *count) {
+    size_t off = 0;
+    while (off < batch.size()) {
+        size_t end = batch.find('\n', off);
+        if (end == std::string::npos || end + 1 - off != kRecordLen) {
+            std::cout << "broken record at " << off << ", length "
+                      << (end == std::string::npos ? batch.size() - off : end + 1 - off) << std::endl;
+            return false;
+        }
+        size_t tag_end = batch.find(' ', off);
+        size_t seq_end = batch.find(' ', tag_end + 1);
+        std::string tag = batch.substr(off, tag_end - off);
+        if (seq_end > end || batch.find_first_not_of('x', seq_end + 1) != end) {
+            std::cout << "corrupted record: " << tag << std::endl;
+            return false;
+        }
+        ++(*count)[tag];
+        off = end + 1;
+    }
+    return true;
+}
+
+// 子进程：写日志进程，收到tag为END的日志后退出；收到残缺日志或超时返回1
+static int Reader() {
+    mylog::ShmRing ring(kName, kSlots);
+    std::map<std::string, size_t> count;
+    int64_t deadline = NowMs() + 10000;
+    while (NowMs() < deadline) {
+        std::string batch;
+        if (ring.Pop(&batch, 1 << 16, kStaleMs) == 0) {
+            usleep(1000);
+            continue;
+        }
+        if (!Check(batch, &count))
+            return 1;
+        if (count["END"] > 0)
+            return 0;
+    }
+    std::cout << "reader timeout" << std::endl;
+    return 1;
+}
+
+// 子进程：一直写tag为name的日志，直到被杀
+static int Writer(const std::string &name) {
+    mylog::ShmRing ring(kName, kSlots);
+    for (size_t i = 0;; ++i)
+        Push(ring, name, i);
+    return 0;
+}
+
+static bool Expect(bool ok, const char *what) {
+    std::cout << (ok ? "OK   " : "FAIL ") << what << std::endl;
+    return ok;
+}
+
+static pid_t Spawn(int (*fn)()) {
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(fn());
+    return pid;
+}
+
+static int ExitCode(pid_t pid) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// 写日志进程被杀后，阻塞写入不会一直等，重启后恢复
+static bool ReaderKilled() {
+    mylog::ShmRing::Unlink(kName);
+    mylog::ShmRing ring(kName, kSlots);
+    bool ok = true;
+
+    pid_t reader = Spawn(Reader);
+    for (size_t i = 0; i < 1000; ++i)
+        ok = Push(ring, "before", i) && ok;
+    ok = Expect(ok, "push while reader alive") && ok;
+    kill(reader, SIGKILL);
+    waitpid(reader, nullptr, 0);
+
+    // 把环写满，之后的阻塞写入应在kWaitMs左右返回false
+    size_t pushed = 0;
+    int64_t start = NowMs(), elapsed = 0;
+    for (size_t i = 0; i < kSlots; ++i) {
+        start = NowMs();
+        if (!Push(ring, "full", i))
+            break;
+        ++pushed;
+    }
+    elapsed = NowMs() - start;
+    ok = Expect(pushed < kSlots && elapsed >= kWaitMs && elapsed < kWaitMs + 1000,
+                "blocking push gives up when reader is dead") && ok;
+
+    // 重启写日志进程：上一个进程可能取到一条日志中间，新进程不能收到残缺的日志
+    reader = Spawn(Reader);
+    bool resumed = true;
+    for (size_t i = 0; i < 1000; ++i)
+        resumed = Push(ring, "after", i) && resumed;
+    resumed = Push(ring, "END", 0) && resumed;
+    ok = Expect(resumed, "push resumes after reader restart") && ok;
+    ok = Expect(ExitCode(reader) == 0, "restarted reader gets only whole records") && ok;
+    return ok;
+}
+
+// 生产者写到一半被杀后，写日志进程跳过它的槽位，其他生产者的日志完整收到
+static bool WriterKilled() {
+    mylog::ShmRing::Unlink(kName);
+    mylog::ShmRing ring(kName, kSlots);
+    bool ok = true;
+
+    std::map<std::string, size_t> count;
+    bool whole = true;
+    for (int round = 0; round < 20 && whole; ++round) {
+        pid_t writer = fork();
+        if (writer == 0)
+            _exit(Writer("w" + std::to_string(round)));
+        // 边取边写，随机时刻杀掉生产者，有机会停在认领了槽位还没发布的时候
+        int64_t until = NowMs() + 5 + round;
+        while (NowMs() < until) {
+            std::string batch;
+            ring.Pop(&batch, 1 << 16, kStaleMs);
+            whole = Check(batch, &count) && whole;
+        }
+        kill(writer, SIGKILL);
+        waitpid(writer, nullptr, 0);
+    }
+    ok = Expect(whole, "records from killed writers are whole") && ok;
+
+    // 新的生产者写完100条后写END，写日志进程要全部收到
+    pid_t writer = fork();
+    if (writer == 0) {
+        mylog::ShmRing wring(kName, kSlots);
+        bool pushed = true;
+        for (size_t i = 0; i < 100; ++i)
+            pushed = Push(wring, "last", i) && pushed;
+        pushed = Push(wring, "END", 0) && pushed;
+        _exit(pushed ? 0 : 1);
+    }
+    int64_t deadline = NowMs() + 10000;
+    while (count["END"] == 0 && NowMs() < deadline && whole) {
+        std::string batch;
+        if (ring.Pop(&batch, 1 << 16, kStaleMs) == 0)
+            usleep(1000);
+        whole = Check(batch, &count) && whole;
+    }
+    ok = Expect(ExitCode(writer) == 0, "writer after crash pushes") && ok;
+    ok = Expect(whole && count["END"] == 1 && count["last"] == 100, "reader recovers from killed writers") && ok;
+    return ok;
+}
+
+int main() {
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    bool ok = ReaderKilled();
+    ok = WriterKilled() && ok;
+    mylog::ShmRing::Unlink(kName);
+    std::cout << (ok ? "all passed" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}
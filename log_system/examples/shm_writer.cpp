@@ -0,0 +1,35 @@
+/* ************************************************************************
+> File Name:     shm_writer.cpp
+> Description:   共享内存日志环的写日志进程。同一主机上各进程的日志器通过
+>                LoggerBuilder::BuildLoggerShm写入同名共享内存，本进程统一落地，
+>                生产者进程崩溃后已写入共享内存的日志仍会被落地
+> Usage:         ./shm_writer /mylog_shm ./logfile/shm.log
+ ************************************************************************/
+#include "../logs_code/MyLog.hpp"
+#include "../logs_code/ShmRing.hpp"
+#include "../logs_code/Util.hpp"
+#include <csignal>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+static std::atomic<bool> g_stop(false);
+
+static void HandleSignal(int) { g_stop = true; }
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "usage: " << argv[0] << " shm_name log_file" << std::endl;
+        return 1;
+    }
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    std::vector<mylog::LogFlush::ptr> flushs;
+    flushs.emplace_back(mylog::LogFlushFactory::CreateLog<mylog::FileFlush>(argv[2]));
+    mylog::ShmLogWriter writer(argv[1], flushs);
+    if (!writer.Valid())
+        return 1;
+    writer.Run(g_stop);
+    return 0;
+}
@@ -11,6 +11,9 @@
 #include "LogFlush.hpp"
 #include "backlog/CliBackupLog.hpp"
 #include "ThreadPoll.hpp"
+#include "RateLimiter.hpp"
+#include "FlightRecorder.hpp"
+#include "ShmRing.hpp"
 
 extern ThreadPool *tp;
 
@@ -18,106 +21,170 @@ namespace mylog {
     class AsyncLogger {
     public:
         using ptr = std::shared_ptr<AsyncLogger>;
-        AsyncLogger(const std::string &logger_name, std::vector<LogFlush::ptr> &flushs, AsyncType type)
+        AsyncLogger(const std::string &logger_name, std::vector<LogFlush::ptr> &flushs, AsyncType type,
+                    RateLimiter::ptr limiter = RateLimiter::ptr(),
+                    FlightRecorder::ptr recorder = FlightRecorder::ptr(),
+                    LogLevel::value recorder_level = LogLevel::value::DEBUG,
+                    ShmRing::ptr shm = ShmRing::ptr())
             : logger_name_(logger_name),//初始化日志器的名字
               flushs_(flushs.begin(), flushs.end()),//添加实例化方式给日志器，如日志输出到文件还是标准输出，可能有多种
-              asyncworker(std::make_shared<AsyncWorker>(//启动异步工作器
+              limiter_(limiter),
+              recorder_(recorder),
+              recorder_level_(recorder_level),
+              async_type_(type),
+              shm_(shm),
+              // 写共享内存环时由写日志进程落地，本进程不需要异步工作器
+              asyncworker(shm ? AsyncWorker::ptr() : std::make_shared<AsyncWorker>(//启动异步工作器
                   std::bind(&AsyncLogger::RealFlush, this, std::placeholders::_1),
                   type)) {}
-        virtual ~AsyncLogger() {};
+        virtual ~AsyncLogger() {
+            if (limiter_) // 把未补报的限流/合并计数落地
+                limiter_->Drain([this](const char *file, size_t line, uint64_t dropped, uint64_t repeated) {
+                    if (repeated > 0)
+                        WriteMessage(LogLevel::value::INFO, file, line,
+                                     ("last message repeated " + std::to_string(repeated) + " times").c_str());
+                    if (dropped > 0)
+                        WriteMessage(LogLevel::value::INFO, file, line,
+                                     (std::to_string(dropped) + " messages suppressed by rate limit").c_str());
+                });
+        };
         std::string Name() { return logger_name_; }
+        // 主动把飞行记录器中的内容落地
+        void DumpFlightRecorder() {
+            if (!recorder_)
+                return;
+            recorder_->Dump(logger_name_, [this](LogMessage &msg) {
+                std::string data = msg.format();
+                Flush(data.c_str(), data.size());
+            });
+        }
         //该函数则是特定日志级别的日志信息的格式化，当外部调用该日志器时，使用debug模式的日志就会进来
         //在serialize时把日志信息中的日志级别定义为DEBUG。
-        void Debug(const std::string &file, size_t line, const std::string format, ...) {
-            // 获取可变参数列表中的格式
+        //file和format来自宏中的字面量，直接以const char*传递，不构造std::string
+        void Debug(const char *file, size_t line, const char *format, ...) {
+            if (!Admit(LogLevel::value::DEBUG, file, line))
+                return;
+            // 获取可变参数列表中的格式，格式化到线程局部缓冲区
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1)
-                perror("vasprintf failed!!!: ");
+            const char *ret = FormatPayload(format, va);
             va_end(va); // 将va指针置空
 
             serialize(LogLevel::value::DEBUG, file, line,
                       ret); // 生成格式化日志信息并写文件
-
-            free(ret);
-            ret = nullptr;
         };
-        void Info(const std::string &file, size_t line, const std::string format, ...) {
+        void Info(const char *file, size_t line, const char *format, ...) {
+            if (!Admit(LogLevel::value::INFO, file, line))
+                return;
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1)
-                perror("vasprintf failed!!!: ");
+            const char *ret = FormatPayload(format, va);
             va_end(va);
 
             serialize(LogLevel::value::INFO, file, line,
                       ret);
-
-            free(ret);
-            ret = nullptr;
         };
-
-        void Warn(const std::string &file, size_t line, const std::string format, ...) {
+        void Warn(const char *file, size_t line, const char *format, ...) {
+            if (!Admit(LogLevel::value::WARN, file, line))
+                return;
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1)
-                perror("vasprintf failed!!!: ");
+            const char *ret = FormatPayload(format, va);
             va_end(va);
 
             serialize(LogLevel::value::WARN, file, line,
                       ret);
-            free(ret);
-            ret = nullptr;
         };
-        void Error(const std::string &file, size_t line, const std::string format, ...) {
+        void Error(const char *file, size_t line, const char *format, ...) {
+            if (!Admit(LogLevel::value::ERROR, file, line))
+                return;
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1)
-                perror("vasprintf failed!!!: ");
+            const char *ret = FormatPayload(format, va);
             va_end(va);
 
             serialize(LogLevel::value::ERROR, file, line,
                       ret);
-
-            free(ret);
-            ret = nullptr;
         };
-        void Fatal(const std::string &file, size_t line, const std::string format, ...) {
+        void Fatal(const char *file, size_t line, const char *format, ...) {
+            if (!Admit(LogLevel::value::FATAL, file, line))
+                return;
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1)
-                perror("vasprintf failed!!!: ");
+            const char *ret = FormatPayload(format, va);
             va_end(va);
 
             serialize(LogLevel::value::FATAL, file, line,
                       ret);
-
-            free(ret);
-            ret = nullptr;
         };
 
     protected:
+        // 把用户信息格式化到线程局部缓冲区，缓冲区只增不减，稳定后不再分配内存
+        static const char *FormatPayload(const char *format, va_list va) {
+            thread_local std::vector<char> buf(256);
+            va_list copy;
+            va_copy(copy, va);
+            int r = vsnprintf(buf.data(), buf.size(), format, copy);
+            va_end(copy);
+            if (r < 0) {
+                perror("vsnprintf failed!!!: ");
+                buf[0] = '\0';
+            } else if (static_cast<size_t>(r) >= buf.size()) {
+                buf.resize(r + 1);
+                vsnprintf(buf.data(), buf.size(), format, va);
+            }
+            return buf.data();
+        }
+
+        // 调用点限流，被丢弃的条数在下个时间窗口补报一条
+        bool Admit(LogLevel::value level, const char *file, size_t line) {
+            if (!limiter_)
+                return true;
+            uint64_t dropped = 0;
+            bool ok = limiter_->Check(file, line, &dropped);
+            if (dropped > 0) {
+                std::string note = std::to_string(dropped) + " messages suppressed by rate limit";
+                WriteMessage(level, file, line, note.c_str());
+            }
+            return ok;
+        }
+
         //在这里将日志消息组织起来，并写入文件
-        void serialize(LogLevel::value level, const std::string &file, size_t line,
-                       char *ret) {
+        void serialize(LogLevel::value level, const char *file, size_t line,
+                       const char *ret) {
+            if (limiter_) {
+                uint64_t repeated = 0;
+                if (!limiter_->Coalesce(file, line, ret, &repeated))
+                    return;
+                if (repeated > 0) {
+                    std::string note = "last message repeated " + std::to_string(repeated) + " times";
+                    WriteMessage(level, file, line, note.c_str());
+                }
+            }
+            WriteMessage(level, file, line, ret);
+        }
+
+        void WriteMessage(LogLevel::value level, const char *file, size_t line,
+                          const char *ret) {
+            if (recorder_) {
+                // 低等级日志只进内存环，出错时先把环中的上下文落地
+                if (level <= recorder_level_) {
+                    recorder_->Append(level, file, line, ret);
+                    return;
+                }
+                if (level >= LogLevel::value::ERROR)
+                    DumpFlightRecorder();
+            }
             // std::cout << "Debug:serialize begin\n";
             LogMessage msg(level, file, line, logger_name_, ret);
-            std::string data = msg.format();
+            thread_local std::string data; // 复用容量，稳定后格式化不再分配内存
+            msg.FormatTo(&data);
             if (level == LogLevel::value::FATAL ||
                 level == LogLevel::value::ERROR)
             {
                 try
                 {
-                    auto ret = tp->enqueue(start_backup, data);
+                    auto ret = tp->enqueue_to(ThreadPool::Priority::HIGH, start_backup, std::string(data));
                     ret.get();
                 }
                 catch (const std::runtime_error &e)
@@ -133,6 +200,10 @@ namespace mylog {
         }
 
         void Flush(const char *data, size_t len) {
+            if (shm_) { // ASYNC_SAFE环满时等待(有上限，见ShmRing::Push)，ASYNC_UNSAFE环满时丢弃
+                shm_->Push(data, len, async_type_ == AsyncType::ASYNC_SAFE);
+                return;
+            }
             asyncworker->Push(data, len); // Push函数本身是线程安全的，这里不加锁
         }
 
@@ -150,6 +221,11 @@ namespace mylog {
         std::string logger_name_;
         std::vector<LogFlush::ptr> flushs_; // 输出到指定方向\
     std::vector<LogFlush> flush_;不能使用logflush作为元素类型，logflush是纯虚类，不能实例化
+        RateLimiter::ptr limiter_; // 为空表示不限流
+        FlightRecorder::ptr recorder_; // 为空表示不启用飞行记录器
+        LogLevel::value recorder_level_; // 不高于该等级的日志只写入飞行记录器
+        AsyncType async_type_;
+        ShmRing::ptr shm_; // 不为空时日志写入多进程共享的内存环
         mylog::AsyncWorker::ptr asyncworker;
     };
 
@@ -160,6 +236,22 @@ namespace mylog {
         using ptr = std::shared_ptr<LoggerBuilder>;
         void BuildLoggerName(const std::string &name) { logger_name_ = name; }
         void BuildLoggerType(AsyncType type) { async_type_ = type; }
+        // 每个调用点interval_ms内最多输出burst条，coalesce为true时合并连续重复的日志
+        void BuildLoggerRateLimit(size_t burst, size_t interval_ms, bool coalesce = true) {
+            limiter_ = std::make_shared<RateLimiter>(burst, interval_ms, coalesce);
+        }
+        // 日志写入名为shm_name的共享内存环，由单独的写日志进程(ShmLogWriter)落地，
+        // 此时BuildLoggerFlush指定的落地方式不生效
+        void BuildLoggerShm(const std::string &shm_name, size_t slots = 1 << 16) {
+            shm_ = std::make_shared<ShmRing>(shm_name, slots);
+            if (!shm_->Valid())
+                shm_.reset(); // 共享内存不可用时退回本进程异步落地
+        }
+        // 不高于level的日志只保留在内存中最近capacity条，ERROR/FATAL时再一并落地
+        void BuildLoggerFlightRecorder(size_t capacity, LogLevel::value level = LogLevel::value::DEBUG) {
+            recorder_ = std::make_shared<FlightRecorder>(capacity);
+            recorder_level_ = level;
+        }
         template <typename FlushType, typename... Args>
         void BuildLoggerFlush(Args &&...args) {
             flushs_.emplace_back(
@@ -172,12 +264,16 @@ namespace mylog {
             if (flushs_.empty())
                 flushs_.emplace_back(std::make_shared<StdoutFlush>());
             return std::make_shared<AsyncLogger>(
-                logger_name_, flushs_, async_type_);
+                logger_name_, flushs_, async_type_, limiter_, recorder_, recorder_level_, shm_);
         }
 
     protected:
         std::string logger_name_ = "async_logger"; // 日志器名称
         std::vector<mylog::LogFlush::ptr> flushs_; // 写日志方式
         AsyncType async_type_ = AsyncType::ASYNC_SAFE;//用于控制缓冲区是否增长
+        RateLimiter::ptr limiter_; // 调用点限流与重复合并，默认关闭
+        FlightRecorder::ptr recorder_; // 飞行记录器，默认关闭
+        LogLevel::value recorder_level_ = LogLevel::value::DEBUG;
+        ShmRing::ptr shm_; // 多进程共享内存环，默认关闭
     };
 } // namespace mylog
\ No newline at end of file
@@ -16,8 +16,8 @@ class AsyncWorker {
     using ptr = std::shared_ptr<AsyncWorker>;
     AsyncWorker(const functor& cb, AsyncType async_type = AsyncType::ASYNC_SAFE)
         : async_type_(async_type),
-          callback_(cb),
           stop_(false),
+          callback_(cb),
           thread_(std::thread(&AsyncWorker::ThreadEntry, this)) {}
     ~AsyncWorker() { Stop(); }
     void Push(const char* data, size_t len) {
@@ -32,7 +32,10 @@ class AsyncWorker {
     }
     void Stop() {
         if (!stop_) {
-            stop_ = true;
+            {  // 持锁修改，避免消费者检查完条件后错过唤醒
+                std::unique_lock<std::mutex> lock(mtx_);
+                stop_ = true;
+            }
             cond_consumer_.notify_all();  // 所有线程把缓冲区内数据处理完就结束了
             if (thread_.joinable()) {
                 thread_.join();
@@ -45,11 +48,10 @@ class AsyncWorker {
         while (1) {
             {  // 缓冲区交换完就解锁，让productor继续写入数据
                 std::unique_lock<std::mutex> lock(mtx_);
-                if (buffer_productor_.IsEmpty() &&
-                    stop_)  // 有数据则交换，无数据就阻塞
-                    cond_consumer_.wait(lock, [&]() {
-                        return stop_ || !buffer_productor_.IsEmpty();
-                    });
+                // 有数据则交换，无数据就阻塞
+                cond_consumer_.wait(lock, [&]() {
+                    return stop_ || !buffer_productor_.IsEmpty();
+                });
                 buffer_productor_.Swap(buffer_consumer_);
                 // 固定容量的缓冲区才需要唤醒
                 if (async_type_ == AsyncType::ASYNC_SAFE)
@@ -69,8 +71,7 @@ class AsyncWorker {
     mylog::Buffer buffer_consumer_;
     std::condition_variable cond_productor_;
     std::condition_variable cond_consumer_;
-    std::thread thread_;
-
     functor callback_;  // 回调函数，用来告知工作器如何落地
+    std::thread thread_;  // 放在最后，保证线程启动时其余成员都已初始化
 };
 }  // namespace mylog
\ No newline at end of file
@@ -0,0 +1,100 @@
+/*飞行记录器：低等级日志只写入内存环形缓冲区，出现ERROR/FATAL或主动调用时再落地*/
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Message.hpp"
+
+namespace mylog {
+    class FlightRecorder {
+    public:
+        using ptr = std::shared_ptr<FlightRecorder>;
+        static constexpr size_t kFileLen = 64;     // 文件名保留末尾部分
+        static constexpr size_t kPayloadLen = 240; // 超出部分截断
+
+        // capacity向上取整为2的幂
+        explicit FlightRecorder(size_t capacity) : head_(0), tail_(0) {
+            size_t cap = 1;
+            while (cap < capacity)
+                cap <<= 1;
+            mask_ = cap - 1;
+            slots_ = std::vector<Slot>(cap);
+        }
+
+        // 追加一条记录，只做定长拷贝，不加锁、不分配内存
+        void Append(LogLevel::value level, const char *file, size_t line, const char *payload) {
+            uint64_t idx = head_.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = slots_[idx & mask_];
+            // seqlock：写入期间序号为奇数，读者据此跳过不完整的槽位
+            slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.ctime = Util::Date::NowNs();
+            slot.tid = pthread_self();
+            slot.level = level;
+            slot.line = line;
+            size_t len = strlen(file);
+            size_t off = len >= kFileLen ? len - kFileLen + 1 : 0;
+            strncpy(slot.file, file + off, kFileLen - 1);
+            slot.file[kFileLen - 1] = '\0';
+            strncpy(slot.payload, payload, kPayloadLen - 1);
+            slot.payload[kPayloadLen - 1] = '\0';
+            slot.seq.store(2 * idx + 2, std::memory_order_release);
+        }
+
+        // 按时间顺序取出上次Dump之后仍留在环中的记录，取出后清空
+        void Dump(const std::string &logger_name, const std::function<void(LogMessage &)> &cb) {
+            std::unique_lock<std::mutex> lock(dump_mtx_);
+            uint64_t head = head_.load(std::memory_order_acquire);
+            uint64_t begin = tail_;
+            if (head - begin > slots_.size()) // 被覆盖的部分已经丢失
+                begin = head - slots_.size();
+            for (uint64_t idx = begin; idx < head; ++idx) {
+                Slot &slot = slots_[idx & mask_];
+                uint64_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq != 2 * idx + 2) // 正在写或已被新记录覆盖
+                    continue;
+                // 先拷出再校验序号，LogMessage只引用拷贝后的内容
+                char file[kFileLen];
+                char payload[kPayloadLen];
+                memcpy(file, slot.file, kFileLen);
+                memcpy(payload, slot.payload, kPayloadLen);
+                LogMessage msg;
+                msg.ctime_ = slot.ctime;
+                msg.tid_ = slot.tid;
+                msg.level_ = slot.level;
+                msg.line_ = slot.line;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != seq)
+                    continue;
+                file[kFileLen - 1] = '\0';
+                payload[kPayloadLen - 1] = '\0';
+                msg.file_name_ = file;
+                msg.name_ = logger_name;
+                msg.payload_ = payload;
+                cb(msg);
+            }
+            tail_ = head;
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> seq{0};
+            int64_t ctime = 0;
+            unsigned long tid = 0;
+            LogLevel::value level = LogLevel::value::DEBUG;
+            size_t line = 0;
+            char file[kFileLen] = {0};
+            char payload[kPayloadLen] = {0};
+        };
+
+        std::atomic<uint64_t> head_; // 下一个写入位置
+        uint64_t tail_;              // 上次Dump到的位置，受dump_mtx_保护
+        size_t mask_;
+        std::vector<Slot> slots_;
+        std::mutex dump_mtx_;
+    };
+} // namespace mylog
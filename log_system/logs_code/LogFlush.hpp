@@ -1,3 +1,4 @@
+#pragma once
 #include <cassert>
 #include <fstream>
 #include <memory>
@@ -16,6 +17,7 @@ namespace mylog {
     class StdoutFlush : public LogFlush {
     public:
         using ptr = std::shared_ptr<StdoutFlush>;
+        ~StdoutFlush() { cout.flush(); }
         void Flush(const char *data, size_t len) override {
             cout.write(data, len);
         }
@@ -33,6 +35,11 @@ namespace mylog {
                 perror(NULL);
             }
         }
+        // 日志器析构时异步线程先落地剩余数据，之后才析构落地方式，这里关闭文件并写出stdio缓冲
+        ~FileFlush() {
+            if(fs_!=NULL)
+                fclose(fs_);
+        }
         void Flush(const char *data, size_t len) override {
             fwrite(data,1,len,fs_);
             if(ferror(fs_)){
@@ -62,6 +69,10 @@ namespace mylog {
             : max_size_(max_size), basename_(filename) {
             Util::File::CreateDirectory(Util::File::Path(filename));
         }
+        ~RollFileFlush() {
+            if(fs_!=NULL)
+                fclose(fs_);
+        }
 
         void Flush(const char *data, size_t len) override {
             // 确认文件大小不满足滚动需求
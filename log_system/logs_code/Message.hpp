@@ -1,44 +1,72 @@
 #pragma once
 
+#include <pthread.h>
+
+#include <cstdio>
 #include <memory>
+#include <string_view>
 #include <thread>
 
 #include "Level.hpp"
 #include "Util.hpp"
 
 namespace mylog {
+  // 只引用外部数据，不拷贝：file来自__FILE__字面量，name为日志器名，
+  // payload为调用线程的格式化缓冲区，三者在format前都保持有效
   struct LogMessage {
     using ptr = std::shared_ptr<LogMessage>;
     LogMessage() = default;
-    LogMessage(LogLevel::value level, std::string file, size_t line,
-               std::string name, std::string payload)
-        : name_(name),
+    LogMessage(LogLevel::value level, const char *file, size_t line,
+               std::string_view name, const char *payload)
+        : line_(line),
+          ctime_(Util::Date::NowNs()),
           file_name_(file),
+          name_(name),
           payload_(payload),
-          level_(level),
-          line_(line),
-          ctime_(Util::Date::Now()),
-          tid_(std::this_thread::get_id()) {}
+          tid_(pthread_self()),
+          level_(level) {}
 
     std::string format() {
-      std::stringstream ret;
-      // 获取当前时间
-      struct tm t;
-      localtime_r(&ctime_, &t);
-      char buf[128];
-      strftime(buf, sizeof(buf), "%H:%M:%S", &t);
-      std::string tmp1 = '[' + std::string(buf) + "][";
-      std::string tmp2 = '[' + std::string(LogLevel::ToString(level_)) + "][" + name_ + "][" + file_name_ + ":" + std::to_string(line_) + "]\t" + payload_ + "\n";
-      ret << tmp1 << tid_ << tmp2;
-      return ret.str();
+      std::string ret;
+      FormatTo(&ret);
+      return ret;
+    }
+
+    // 格式化到out中(覆盖原内容)，out的容量可复用，稳定后不再分配内存
+    void FormatTo(std::string *out) {
+      // 时间精确到微秒，同一秒内的日志不再重复调用localtime_r
+      thread_local time_t last_sec = -1;
+      thread_local char sec_buf[32];
+      time_t sec = static_cast<time_t>(ctime_ / 1000000000);
+      if (sec != last_sec) {
+        struct tm t;
+        localtime_r(&sec, &t);
+        strftime(sec_buf, sizeof(sec_buf), "%H:%M:%S", &t);
+        last_sec = sec;
+      }
+      char head[128];
+      int n = snprintf(head, sizeof(head), "[%s.%06d][%lu[%s][", sec_buf,
+                       static_cast<int>(ctime_ % 1000000000 / 1000), tid_,
+                       LogLevel::ToString(level_));
+      char line_buf[32];
+      int m = snprintf(line_buf, sizeof(line_buf), ":%zu]\t", line_);
+
+      out->clear();
+      out->append(head, n);
+      out->append(name_.data(), name_.size());
+      out->append("][", 2);
+      out->append(file_name_.data(), file_name_.size());
+      out->append(line_buf, m);
+      out->append(payload_.data(), payload_.size());
+      out->push_back('\n');
     }
 
-    size_t line_;           // 行号
-    time_t ctime_;          // 时间
-    std::string file_name_; // 文件名
-    std::string name_;      // 日志器名
-    std::string payload_;   // 信息体
-    std::thread::id tid_;   // 线程id
-    LogLevel::value level_; // 等级
+    size_t line_;                // 行号
+    int64_t ctime_;              // 时间，纳秒级时间戳
+    std::string_view file_name_; // 文件名
+    std::string_view name_;      // 日志器名
+    std::string_view payload_;   // 信息体
+    unsigned long tid_;          // 线程id
+    LogLevel::value level_;      // 等级
   };
-} // namespace mylog
\ No newline at end of file
+} // namespace mylog
@@ -0,0 +1,154 @@
+/*按调用点(文件名+行号)限流，并合并连续重复的日志*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mylog {
+    class RateLimiter {
+    public:
+        using ptr = std::shared_ptr<RateLimiter>;
+        // burst: 每个调用点在interval_ms内最多输出的条数，为0表示不限流
+        // coalesce: 同一调用点连续输出相同内容时只计数，不重复写入
+        RateLimiter(size_t burst, size_t interval_ms, bool coalesce, size_t slots = 4096)
+            : burst_(burst),
+              interval_ms_(interval_ms == 0 ? 1 : interval_ms),
+              coalesce_(coalesce),
+              mask_(RoundUp(slots) - 1),
+              slots_(mask_ + 1) {}
+
+        // 限流检查，在格式化之前调用，返回false表示本条被丢弃
+        // *dropped返回上个时间窗口内被丢弃、需要补报的条数
+        bool Check(const char *file, size_t line, uint64_t *dropped) {
+            *dropped = 0;
+            if (burst_ == 0)
+                return true;
+            Slot *slot = Find(file, line);
+            if (slot == nullptr) // 槽位用尽时放行，宁可多写也不丢日志
+                return true;
+            int64_t window = NowWindow();
+            int64_t old = slot->window.load(std::memory_order_relaxed);
+            if (old != window &&
+                slot->window.compare_exchange_strong(old, window, std::memory_order_relaxed)) {
+                slot->count.store(0, std::memory_order_relaxed);
+                *dropped = slot->dropped.exchange(0, std::memory_order_relaxed);
+            }
+            if (slot->count.fetch_add(1, std::memory_order_relaxed) < burst_)
+                return true;
+            slot->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // 重复内容检查，在格式化之后调用，返回false表示与上一条相同，本条被合并
+        // *repeated返回被合并、需要补报的条数；相同内容每个时间窗口至少输出一次
+        bool Coalesce(const char *file, size_t line, const char *payload, uint64_t *repeated) {
+            *repeated = 0;
+            if (!coalesce_)
+                return true;
+            Slot *slot = Find(file, line);
+            if (slot == nullptr)
+                return true;
+            uint64_t hash = Hash(payload, 0);
+            int64_t window = NowWindow();
+            uint64_t prev = slot->last_hash.exchange(hash, std::memory_order_relaxed);
+            int64_t last_emit = slot->last_emit.load(std::memory_order_relaxed);
+            if (prev == hash && last_emit == window) {
+                slot->repeated.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            slot->last_emit.store(window, std::memory_order_relaxed);
+            *repeated = slot->repeated.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        // 取出所有尚未补报的计数，日志器析构前调用，避免静默丢失
+        void Drain(const std::function<void(const char *, size_t, uint64_t, uint64_t)> &report) {
+            for (auto &slot : slots_) {
+                if (slot.key.load(std::memory_order_acquire) == 0)
+                    continue;
+                uint64_t dropped = slot.dropped.exchange(0, std::memory_order_relaxed);
+                uint64_t repeated = slot.repeated.exchange(0, std::memory_order_relaxed);
+                if (dropped > 0 || repeated > 0)
+                    report(slot.file, slot.line, dropped, repeated);
+            }
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> key{0};
+            std::atomic<int64_t> window{-1};
+            std::atomic<size_t> count{0};
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<uint64_t> last_hash{0};
+            std::atomic<int64_t> last_emit{-1};
+            std::atomic<uint64_t> repeated{0};
+            char file[128] = {0}; // 占用槽位时记录，仅用于Drain补报
+            size_t line = 0;
+        };
+
+        static size_t RoundUp(size_t n) {
+            size_t ret = 1;
+            while (ret < n)
+                ret <<= 1;
+            return ret;
+        }
+
+        // FNV-1a
+        static uint64_t Hash(const char *data, uint64_t seed) {
+            uint64_t h = 14695981039346656037ULL ^ seed;
+            for (; *data; ++data) {
+                h ^= static_cast<unsigned char>(*data);
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        static uint64_t SiteKey(const char *file, size_t line) {
+            uint64_t key = Hash(file, line * 0x9E3779B97F4A7C15ULL);
+            return key == 0 ? 1 : key; // 0表示空槽
+        }
+
+        // 开放寻址查找/占用槽位，只用CAS不加锁
+        Slot *Find(const char *file, size_t line) {
+            uint64_t key = SiteKey(file, line);
+            for (size_t i = 0; i < kMaxProbe; ++i) {
+                Slot &slot = slots_[(key + i) & mask_];
+                uint64_t cur = slot.key.load(std::memory_order_acquire);
+                if (cur == key)
+                    return &slot;
+                if (cur == 0) {
+                    if (slot.key.compare_exchange_strong(cur, key, std::memory_order_acq_rel)) {
+                        // 保留文件名末尾部分
+                        size_t len = strlen(file);
+                        size_t off = len >= sizeof(slot.file) ? len - sizeof(slot.file) + 1 : 0;
+                        strncpy(slot.file, file + off, sizeof(slot.file) - 1);
+                        slot.line = line;
+                        return &slot;
+                    }
+                    if (cur == key)
+                        return &slot;
+                }
+            }
+            return nullptr;
+        }
+
+        int64_t NowWindow() const {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+            return ms / static_cast<int64_t>(interval_ms_);
+        }
+
+    private:
+        static constexpr size_t kMaxProbe = 16;
+        size_t burst_;
+        size_t interval_ms_;
+        bool coalesce_;
+        size_t mask_;
+        std::vector<Slot> slots_;
+    };
+} // namespace mylog
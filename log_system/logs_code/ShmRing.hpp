@@ -0,0 +1,284 @@
+/*多进程共享内存日志环：各进程的日志器直接写入共享内存，由单独的写日志进程统一落地*/
+#pragma once
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LogFlush.hpp"
+
+namespace mylog {
+    class ShmRing {
+    public:
+        using ptr = std::shared_ptr<ShmRing>;
+        static constexpr uint64_t kMagic = 0x4d594c4f47524e47ULL; // "MYLOGRNG"
+        static constexpr size_t kSlotSize = 256;
+        static constexpr size_t kSlotData = kSlotSize - 16;
+        static constexpr uint16_t kMore = 1; // 一条日志跨多个槽位，后面还有
+        static constexpr uint16_t kHead = 2; // 一条日志的第一个槽位
+        static constexpr int64_t kBlockWaitMs = 1000; // 阻塞写入时环满最多等待的时间
+
+        // 打开(不存在则创建)名为name的共享内存环，slots向上取整为2的幂，
+        // 只在创建时生效，之后打开的进程沿用已有的容量
+        ShmRing(const std::string &name, size_t slots = 1 << 16) : name_(name) {
+            size_t cap = 1;
+            while (cap < slots)
+                cap <<= 1;
+            size_ = sizeof(Header) + cap * kSlotSize;
+
+            bool creator = true;
+            int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (fd == -1 && errno == EEXIST) {
+                creator = false;
+                fd = shm_open(name.c_str(), O_RDWR, 0644);
+            }
+            if (fd == -1) {
+                std::cout << __FILE__ << __LINE__ << "shm_open failed: " << strerror(errno) << std::endl;
+                return;
+            }
+            if (creator && ftruncate(fd, size_) == -1) {
+                std::cout << __FILE__ << __LINE__ << "ftruncate shm failed: " << strerror(errno) << std::endl;
+                close(fd);
+                return;
+            }
+            if (!creator) { // 等待创建者把大小设置好，容量以已存在的共享内存为准
+                struct stat st;
+                st.st_size = 0;
+                for (int i = 0; i < 1000; ++i) {
+                    if (fstat(fd, &st) == 0 && st.st_size > 0)
+                        break;
+                    usleep(1000);
+                }
+                if ((size_t)st.st_size < sizeof(Header) + kSlotSize) {
+                    std::cout << __FILE__ << __LINE__ << "shm ring not initialized" << std::endl;
+                    close(fd);
+                    return;
+                }
+                size_ = st.st_size;
+                cap = (size_ - sizeof(Header)) / kSlotSize;
+            }
+            void *addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED) {
+                std::cout << __FILE__ << __LINE__ << "mmap shm failed: " << strerror(errno) << std::endl;
+                return;
+            }
+            header_ = static_cast<Header *>(addr);
+            slots_ = reinterpret_cast<Slot *>(static_cast<char *>(addr) + sizeof(Header));
+            if (creator) {
+                header_->capacity = cap;
+                for (size_t i = 0; i < cap; ++i)
+                    new (&slots_[i]) Slot(i);
+                new (&header_->head) std::atomic<uint64_t>(0);
+                new (&header_->tail) std::atomic<uint64_t>(0);
+                new (&header_->dropped) std::atomic<uint64_t>(0);
+                new (&header_->magic) std::atomic<uint64_t>(0);
+                header_->magic.store(kMagic, std::memory_order_release);
+            } else {
+                for (int i = 0; i < 1000 && header_->magic.load(std::memory_order_acquire) != kMagic; ++i)
+                    usleep(1000);
+                if (header_->magic.load(std::memory_order_acquire) != kMagic || header_->capacity != cap) {
+                    std::cout << __FILE__ << __LINE__ << "shm ring header invalid" << std::endl;
+                    munmap(addr, size_);
+                    header_ = nullptr;
+                    slots_ = nullptr;
+                    return;
+                }
+            }
+            mask_ = cap - 1;
+        }
+        ~ShmRing() {
+            if (header_)
+                munmap(header_, size_);
+        }
+        bool Valid() const { return header_ != nullptr; }
+        // 删除共享内存名字，已映射的进程不受影响
+        static void Unlink(const std::string &name) { shm_unlink(name.c_str()); }
+
+        // 生产者：写入一条完整的日志。环满时block为true则最多等待wait_ms，否则直接丢弃；
+        // 丢弃时计数并返回false。写日志进程退出后环不会再腾出槽位，不能一直等下去
+        bool Push(const char *data, size_t len, bool block = true, int64_t wait_ms = kBlockWaitMs) {
+            if (!Valid() || len == 0)
+                return false;
+            size_t need = (len + kSlotData - 1) / kSlotData;
+            if (need > mask_ + 1) {
+                header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            uint64_t pos;
+            int64_t deadline = 0; // 第一次发现环满时才取时间
+            for (;;) {
+                pos = header_->head.load(std::memory_order_relaxed);
+                // 消费者按顺序释放槽位，最后一个槽位空闲则之前的都空闲
+                Slot &last = slots_[(pos + need - 1) & mask_];
+                uint64_t seq = last.seq.load(std::memory_order_acquire);
+                if (seq == pos + need - 1) {
+                    if (header_->head.compare_exchange_weak(pos, pos + need, std::memory_order_relaxed))
+                        break;
+                } else if (seq < pos + need - 1) { // 环满
+                    int64_t now = block ? NowMs() : 0;
+                    if (block && deadline == 0)
+                        deadline = now + wait_ms;
+                    if (!block || now >= deadline) {
+                        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    sched_yield();
+                }
+            }
+            pid_t pid = getpid();
+            for (size_t i = 0; i < need; ++i) {
+                Slot &slot = slots_[(pos + i) & mask_];
+                slot.owner.store(pid, std::memory_order_relaxed);
+                size_t n = std::min(kSlotData, len - i * kSlotData);
+                memcpy(slot.data, data + i * kSlotData, n);
+                slot.len = static_cast<uint16_t>(n);
+                slot.flags = (i == 0 ? kHead : 0) | (i + 1 < need ? kMore : 0);
+                slot.seq.store(pos + i + 1, std::memory_order_release);
+            }
+            return true;
+        }
+
+        // 消费者：把已发布的完整日志追加到out，最多约max_bytes，返回取出的槽位数
+        // 写入中途崩溃的生产者留下的槽位，超过stale_ms后跳过，它所在的那条日志整条丢弃。
+        // 上一个写日志进程取到一条日志中间时退出，重启后从那条日志余下的槽位开始，这些槽位也丢弃
+        size_t Pop(std::string *out, size_t max_bytes, int64_t stale_ms = 1000) {
+            if (!Valid())
+                return 0;
+            size_t cnt = 0;
+            uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+            while (out->size() < max_bytes) {
+                Slot &slot = slots_[tail & mask_];
+                uint64_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq == tail + 1) {
+                    // 跨槽位的日志先攒在record_中，最后一段到了才交出去
+                    bool head = slot.flags & kHead;
+                    if (head && !record_.empty()) { // 上一条没收完，不和这一条拼在一起
+                        record_.clear();
+                        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    if (head || !record_.empty())
+                        record_.append(slot.data, slot.len);
+                    if (!(slot.flags & kMore)) {
+                        if (record_.empty()) // 开头已被上一个写日志进程取走
+                            header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                        out->append(record_);
+                        record_.clear();
+                    }
+                    stale_since_ = 0;
+                } else if (header_->head.load(std::memory_order_acquire) > tail && IsStale(slot, stale_ms)) {
+                    stale_since_ = 0; // 生产者已退出，丢弃这个未完成的槽位
+                    if (!record_.empty()) {
+                        record_.clear();
+                        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } else {
+                    break;
+                }
+                // 先清掉owner再释放槽位，下一圈认领它的生产者还没写入owner时，这里不会留着上一圈的pid
+                slot.owner.store(0, std::memory_order_relaxed);
+                slot.seq.store(tail + mask_ + 1, std::memory_order_release);
+                header_->tail.store(++tail, std::memory_order_release);
+                ++cnt;
+            }
+            return cnt;
+        }
+
+        uint64_t Dropped() const { return Valid() ? header_->dropped.load(std::memory_order_relaxed) : 0; }
+
+    private:
+        struct Slot {
+            explicit Slot(uint64_t s) : seq(s), owner(0), len(0), flags(0) {}
+            std::atomic<uint64_t> seq; // == pos 空闲；== pos + 1 已发布
+            std::atomic<int32_t> owner;
+            uint16_t len;
+            uint16_t flags;
+            char data[kSlotData];
+        };
+        static_assert(sizeof(Slot) == kSlotSize, "unexpected shm slot size");
+
+        struct Header {
+            std::atomic<uint64_t> magic;
+            uint64_t capacity;
+            std::atomic<uint64_t> dropped;
+            char pad0[40];
+            std::atomic<uint64_t> head; // 生产者与消费者分开在不同缓存行
+            char pad1[56];
+            std::atomic<uint64_t> tail;
+            char pad2[56];
+        };
+
+        static int64_t NowMs() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        bool IsStale(Slot &slot, int64_t stale_ms) {
+            int64_t now = NowMs();
+            if (stale_since_ == 0) {
+                stale_since_ = now;
+                return false;
+            }
+            // owner为0：槽位已被认领但生产者没来得及写入owner，超时后同样按已退出处理
+            pid_t owner = slot.owner.load(std::memory_order_relaxed);
+            bool dead = owner == 0 || (kill(owner, 0) == -1 && errno == ESRCH);
+            return dead && now - stale_since_ >= stale_ms;
+        }
+
+    private:
+        std::string name_;
+        size_t size_ = 0;
+        size_t mask_ = 0;
+        Header *header_ = nullptr;
+        Slot *slots_ = nullptr;
+        int64_t stale_since_ = 0; // 只在消费者进程中使用
+        std::string record_;      // 消费者：跨槽位日志已到的部分
+    };
+
+    // 单独的写日志进程使用：从共享内存环批量取出数据交给各落地方式，
+    // 一批数据只调用一次Flush，多进程的fsync合并为一次
+    class ShmLogWriter {
+    public:
+        ShmLogWriter(const std::string &name, std::vector<LogFlush::ptr> &flushs,
+                     size_t slots = 1 << 16, size_t batch_bytes = 1 << 20)
+            : ring_(name, slots), flushs_(flushs.begin(), flushs.end()), batch_bytes_(batch_bytes) {}
+
+        // 取一批并落地，返回本批字节数
+        size_t RunOnce() {
+            batch_.clear();
+            ring_.Pop(&batch_, batch_bytes_);
+            if (!batch_.empty())
+                for (auto &e : flushs_)
+                    e->Flush(batch_.data(), batch_.size());
+            return batch_.size();
+        }
+
+        // 循环落地直到stop为true，退出前把剩余数据取完
+        void Run(const std::atomic<bool> &stop) {
+            while (!stop.load()) {
+                if (RunOnce() == 0)
+                    usleep(1000);
+            }
+            while (RunOnce() > 0) {
+            }
+        }
+        bool Valid() const { return ring_.Valid(); }
+
+    private:
+        ShmRing ring_;
+        std::vector<LogFlush::ptr> flushs_;
+        size_t batch_bytes_;
+        std::string batch_;
+    };
+} // namespace mylog
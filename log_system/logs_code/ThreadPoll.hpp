@@ -8,16 +8,34 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <chrono>
+#include <iterator>
+#include "TimerWheel.hpp"
 
 class ThreadPool {
 public:
+    // 任务优先级通道：HIGH用于日志备份、请求卸载等延迟敏感任务，
+    // LOW用于压缩、巡检等批量后台任务。工作线程总是先取高优先级通道
+    enum class Priority { HIGH = 0, NORMAL = 1, LOW = 2 };
+    // 有界通道满时的处理方式：BLOCK阻塞等待，REJECT抛出异常
+    enum class OverflowPolicy { BLOCK, REJECT };
+
+    struct LaneStats {
+        size_t depth = 0;          // 当前排队任务数
+        size_t max_depth = 0;      // 历史最大排队数
+        uint64_t enqueued = 0;     // 累计入队数
+        uint64_t rejected = 0;     // 累计被拒绝数
+        uint64_t total_wait_ns = 0; // 累计排队时间
+        uint64_t max_wait_ns = 0;   // 最大排队时间
+    };
+
     // 该函数用于初始化线程池，启动指定数量的线程。
     // 对于每个线程，使用 std::thread 创建一个新线程，并将一个 lambda 函数作为线程的执行体。
     // 在 lambda 函数中，线程会进入一个无限循环，不断尝试从任务队列中获取任务。
     // 使用 std::unique_lock<std::mutex> 加锁，确保线程安全地访问任务队列。
-    // 调用 condition.wait(lock, [this]{ return this->stop || !this->tasks.empty(); }) 使线程进入等待状态，直到满足以下两个条件之一：线程池停止（stop 为 true）或任务队列不为空。
-    // 如果线程池停止且任务队列为空，线程会退出循环。
-    // 从任务队列中取出一个任务，并将其移动到局部变量 task 中，然后解锁。
+    // 调用 condition.wait(lock, ...) 使线程进入等待状态，直到满足以下两个条件之一：线程池停止（stop 为 true）或任一通道不为空。
+    // 如果线程池停止且所有通道为空，线程会退出循环。
+    // 按优先级从高到低取出一个任务，并将其移动到局部变量 task 中，然后解锁。
     // 执行取出的任务。
     ThreadPool(size_t threads) // 启动部分线程
         : stop(false) {
@@ -31,12 +49,11 @@ public:
                             // 等待任务队列不为空或线程池停止
                             this->condition.wait(lock,
                                                  [this]
-                                                 { return this->stop || !this->tasks.empty(); });
-                            if (this->stop && this->tasks.empty())
+                                                 { return this->stop || this->pending > 0; });
+                            if (this->stop && this->pending == 0)
                                 return;
                             //取出任务
-                            task = std::move(this->tasks.front());
-                            this->tasks.pop();
+                            task = this->PopLocked();
                         }
                         // 执行任务
                         task();
@@ -44,6 +61,14 @@ public:
                 });
         }
     }
+
+    // 设置某个通道的容量上限，capacity为0表示不限
+    void set_lane_limit(Priority lane, size_t capacity, OverflowPolicy policy = OverflowPolicy::BLOCK) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        lanes[Index(lane)].capacity = capacity;
+        lanes[Index(lane)].policy = policy;
+    }
+
     template <class F, class... Args>
     // 该函数用于将一个新任务添加到任务队列中，并返回一个 std::future 对象，用于获取任务的执行结果。
     // 使用 std::packaged_task 将传入的函数 f 和参数 args 打包成一个可调用对象。
@@ -54,6 +79,13 @@ public:
     // 调用 condition.notify_one() 唤醒一个等待的线程，通知它有新任务可用。
     // 返回 std::future 对象。
     auto enqueue(F &&f, Args &&...args)
+        -> std::future<typename std::result_of<F(Args...)>::type> {
+        return enqueue_to(Priority::NORMAL, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // 同enqueue，但指定优先级通道。通道已满时按该通道的OverflowPolicy阻塞或抛出异常
+    template <class F, class... Args>
+    auto enqueue_to(Priority lane, F &&f, Args &&...args)
         -> std::future<typename std::result_of<F(Args...)>::type> {
         using return_type = typename std::result_of<F(Args...)>::type;
 
@@ -64,31 +96,160 @@ public:
         std::future<return_type> res = task->get_future();
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
-
-            if (stop)// 如果线程池已停止，抛出异常
-                throw std::runtime_error("enqueue on stopped ThreadPool");
+            WaitForSpaceLocked(lock, lane, 1);
             // 将任务添加到任务队列
-            tasks.emplace([task]()
-                          { (*task)(); });
+            PushLocked(lane, [task]()
+                       { (*task)(); });
         }
         condition.notify_one();
         return res;
     }
+
+    // 批量提交[first, last)中的void()任务：只加一次锁、只通知一次。
+    // 有界通道需要一次容纳整批任务，否则按策略阻塞或抛出异常
+    template <class It>
+    void enqueue_bulk(Priority lane, It first, It last) {
+        size_t n = std::distance(first, last);
+        if (n == 0)
+            return;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            WaitForSpaceLocked(lock, lane, n);
+            for (; first != last; ++first)
+                PushLocked(lane, std::function<void()>(*first));
+        }
+        if (n == 1)
+            condition.notify_one();
+        else
+            condition.notify_all();
+    }
+
+    using TimerId = TimerWheel::TimerId;
+    // 延迟任务：delay后把f提交到lane通道执行。时间轮在第一次调用时创建
+    template <class F>
+    TimerId schedule_after(std::chrono::milliseconds delay, F &&f, Priority lane = Priority::NORMAL) {
+        return Timer()->ScheduleAfter(delay, Forwarder(lane, std::forward<F>(f)));
+    }
+    // 周期任务：每隔period把f提交到lane通道执行一次
+    template <class F>
+    TimerId schedule_every(std::chrono::milliseconds period, F &&f, Priority lane = Priority::NORMAL) {
+        return Timer()->ScheduleEvery(period, Forwarder(lane, std::forward<F>(f)));
+    }
+    // 取消延迟/周期任务，已经提交到通道中的那一次不受影响
+    bool cancel(TimerId id) {
+        std::unique_lock<std::mutex> lock(timer_mutex);
+        return timer ? timer->Cancel(id) : false;
+    }
+
+    LaneStats stats(Priority lane) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        const Lane &l = lanes[Index(lane)];
+        LaneStats s = l.stats;
+        s.depth = l.tasks.size();
+        return s;
+    }
+
     ~ThreadPool() {
+        timer.reset(); // 先停时间轮，不再有新的定时任务提交进来
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
             stop = true;
         }
         condition.notify_all();
+        not_full.notify_all();
         for (std::thread &worker : workers) {
             worker.join();
         }
     }
 
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Item {
+        std::function<void()> fn;
+        Clock::time_point enqueue_time;
+    };
+    struct Lane {
+        std::queue<Item> tasks; // 任务队列
+        size_t capacity = 0;    // 0表示不限
+        OverflowPolicy policy = OverflowPolicy::BLOCK;
+        LaneStats stats;
+    };
+    static constexpr size_t kLanes = 3;
+
+    static size_t Index(Priority lane) { return static_cast<size_t>(lane); }
+
+    TimerWheel *Timer() {
+        std::unique_lock<std::mutex> lock(timer_mutex);
+        if (!timer)
+            timer.reset(new TimerWheel());
+        return timer.get();
+    }
+
+    // 时间轮线程只负责把到期任务转交给线程池，通道满或已停止时丢弃本次
+    template <class F>
+    TimerWheel::Callback Forwarder(Priority lane, F &&f) {
+        auto fn = std::make_shared<std::function<void()>>(std::forward<F>(f));
+        return [this, lane, fn]() {
+            std::function<void()> once = [fn]() { (*fn)(); };
+            try {
+                enqueue_bulk(lane, &once, &once + 1);
+            } catch (const std::runtime_error &e) {
+            }
+        };
+    }
+
+    // 调用方已持有queue_mutex
+    void WaitForSpaceLocked(std::unique_lock<std::mutex> &lock, Priority lane, size_t n) {
+        if (stop)// 如果线程池已停止，抛出异常
+            throw std::runtime_error("enqueue on stopped ThreadPool");
+        Lane &l = lanes[Index(lane)];
+        if (l.capacity == 0 || l.tasks.size() + n <= l.capacity)
+            return;
+        if (l.policy == OverflowPolicy::REJECT || n > l.capacity) {
+            l.stats.rejected += n;
+            throw std::runtime_error("ThreadPool lane is full");
+        }
+        not_full.wait(lock, [&] { return stop || l.tasks.size() + n <= l.capacity; });
+        if (stop)
+            throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    void PushLocked(Priority lane, std::function<void()> fn) {
+        Lane &l = lanes[Index(lane)];
+        l.tasks.push(Item{std::move(fn), Clock::now()});
+        ++pending;
+        ++l.stats.enqueued;
+        if (l.tasks.size() > l.stats.max_depth)
+            l.stats.max_depth = l.tasks.size();
+    }
+
+    std::function<void()> PopLocked() {
+        for (auto &l : lanes) {
+            if (l.tasks.empty())
+                continue;
+            Item item = std::move(l.tasks.front());
+            l.tasks.pop();
+            --pending;
+            uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                Clock::now() - item.enqueue_time).count();
+            l.stats.total_wait_ns += wait;
+            if (wait > l.stats.max_wait_ns)
+                l.stats.max_wait_ns = wait;
+            if (l.capacity != 0)
+                not_full.notify_all();
+            return std::move(item.fn);
+        }
+        return std::function<void()>();
+    }
+
 private:
     std::vector<std::thread> workers;        // 线程们
-    std::queue<std::function<void()>> tasks; // 任务队列
+    Lane lanes[kLanes];                      // 按优先级排列的任务通道
+    size_t pending = 0;                      // 所有通道中的任务总数
     std::mutex queue_mutex;                  // 任务队列的互斥锁
     std::condition_variable condition;       // 条件变量，用于任务队列的同步
+    std::condition_variable not_full;        // 有界通道有空位时通知阻塞的提交者
     bool stop;
-};
\ No newline at end of file
+    std::unique_ptr<TimerWheel> timer;       // 延迟/周期任务调度
+    std::mutex timer_mutex;
+};
@@ -0,0 +1,209 @@
+/*分层时间轮：O(1)插入、取消与到期，用于延迟任务和周期任务*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class TimerWheel {
+public:
+    using TimerId = uint64_t; // 0表示无效
+    using Callback = std::function<void()>;
+
+    // tick_ms为时间轮精度，定时器最多晚一个tick触发。
+    // 回调在时间轮自己的线程中执行，耗时操作应转交给线程池
+    explicit TimerWheel(uint32_t tick_ms = 1)
+        : tick_ms_(tick_ms == 0 ? 1 : tick_ms), start_(Clock::now()), current_(0) {
+        for (auto &level : wheels_)
+            for (auto &slot : level)
+                slot.prev = slot.next = &slot;
+        thread_ = std::thread(&TimerWheel::ThreadEntry, this);
+    }
+    ~TimerWheel() {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
+        for (auto &e : timers_)
+            delete e.second;
+    }
+
+    // delay后执行一次
+    TimerId ScheduleAfter(std::chrono::milliseconds delay, Callback cb) {
+        return Add(delay, std::chrono::milliseconds(0), std::move(cb));
+    }
+    // 每隔period执行一次，首次在period后执行
+    TimerId ScheduleEvery(std::chrono::milliseconds period, Callback cb) {
+        if (period.count() <= 0)
+            period = std::chrono::milliseconds(tick_ms_);
+        return Add(period, period, std::move(cb));
+    }
+    // 取消尚未触发的定时器；周期定时器取消后不再触发。返回false表示不存在或已触发
+    bool Cancel(TimerId id) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto it = timers_.find(id);
+        if (it == timers_.end())
+            return false;
+        Unlink(it->second);
+        delete it->second;
+        timers_.erase(it);
+        return true;
+    }
+    size_t Size() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return timers_.size();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    // 第0层256个槽，每格1个tick；其余各层64个槽，每格是上一层一整圈
+    static constexpr int kLevels = 5;
+    static constexpr int kBits0 = 8;
+    static constexpr int kBitsN = 6;
+    static constexpr uint64_t kMask0 = (1u << kBits0) - 1;
+    static constexpr uint64_t kMaskN = (1u << kBitsN) - 1;
+    static constexpr uint64_t kMaxDelay = (1ULL << (kBits0 + kBitsN * (kLevels - 1))) - 1;
+
+    struct Node {
+        Node *prev = nullptr;
+        Node *next = nullptr;
+        TimerId id = 0;
+        uint64_t expires = 0; // 到期tick
+        uint64_t period = 0;  // 周期，单位tick，0为一次性
+        Callback cb;
+    };
+
+    static int Shift(int level) { return level == 0 ? 0 : kBits0 + kBitsN * (level - 1); }
+
+    TimerId Add(std::chrono::milliseconds delay, std::chrono::milliseconds period, Callback cb) {
+        Node *node = new Node;
+        node->cb = std::move(cb);
+        node->period = (period.count() + tick_ms_ - 1) / tick_ms_;
+        uint64_t ticks = delay.count() <= 0 ? 0 : (delay.count() + tick_ms_ - 1) / tick_ms_;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            node->id = ++next_id_;
+            // 以当前真实时间为基准，避免时间轮线程落后时定时器提前触发
+            node->expires = std::max(current_, NowTick()) + ticks;
+            timers_[node->id] = node;
+            Insert(node);
+        }
+        cond_.notify_one();
+        return node->id;
+    }
+
+    // 调用方持锁
+    void Insert(Node *node) {
+        uint64_t expires = node->expires;
+        if (expires < current_)
+            expires = current_;
+        uint64_t diff = expires - current_;
+        if (diff > kMaxDelay) {
+            diff = kMaxDelay;
+            expires = current_ + diff;
+            node->expires = expires;
+        }
+        int level = 0;
+        while (level < kLevels - 1 && diff >= (1ULL << Shift(level + 1)))
+            ++level;
+        uint64_t mask = level == 0 ? kMask0 : kMaskN;
+        Node &head = wheels_[level][(expires >> Shift(level)) & mask];
+        node->prev = head.prev;
+        node->next = &head;
+        head.prev->next = node;
+        head.prev = node;
+    }
+
+    static void Unlink(Node *node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+    }
+
+    // 把上层一个槽中的定时器重新分配到下层
+    void Cascade(int level, size_t index) {
+        Node &head = wheels_[level][index];
+        Node *node = head.next;
+        head.prev = head.next = &head;
+        while (node != &head) {
+            Node *next = node->next;
+            Insert(node);
+            node = next;
+        }
+    }
+
+    // 推进到target tick，把到期回调收集到due中。调用方持锁
+    void Advance(uint64_t target, std::vector<Callback> *due) {
+        while (current_ <= target) {
+            size_t index = current_ & kMask0;
+            if (index == 0) {
+                for (int level = 1; level < kLevels; ++level) {
+                    size_t i = (current_ >> Shift(level)) & kMaskN;
+                    Cascade(level, i);
+                    if (i != 0)
+                        break;
+                }
+            }
+            Node &head = wheels_[0][index];
+            while (head.next != &head) {
+                Node *node = head.next;
+                Unlink(node);
+                due->push_back(node->cb);
+                if (node->period > 0) {
+                    node->expires = current_ + node->period;
+                    Insert(node);
+                } else {
+                    timers_.erase(node->id);
+                    delete node;
+                }
+            }
+            ++current_;
+        }
+    }
+
+    uint64_t NowTick() const {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_).count();
+        return ms / tick_ms_;
+    }
+
+    void ThreadEntry() {
+        std::vector<Callback> due;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                // 没有定时器时一直等待，有定时器时每个tick醒一次
+                if (timers_.empty())
+                    cond_.wait(lock, [&] { return stop_ || !timers_.empty(); });
+                else
+                    cond_.wait_for(lock, std::chrono::milliseconds(tick_ms_));
+                if (stop_)
+                    return;
+                uint64_t now = NowTick();
+                if (now >= current_)
+                    Advance(now, &due);
+            }
+            // 在锁外执行回调，回调中可以再添加或取消定时器
+            for (auto &cb : due)
+                cb();
+            due.clear();
+        }
+    }
+
+private:
+    uint32_t tick_ms_;
+    Clock::time_point start_;
+    uint64_t current_;  // 下一个要处理的tick
+    TimerId next_id_ = 0;
+    bool stop_ = false;
+    Node wheels_[kLevels][1 << kBits0]; // 第1层以上只用前64个槽
+    std::unordered_map<TimerId, Node *> timers_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::thread thread_;
+};
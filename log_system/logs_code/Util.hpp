@@ -13,6 +13,13 @@ namespace mylog {
         class Date {
         public:
             static time_t Now() { return time(nullptr); }
+            // 纳秒级时间戳(自1970年起)。CLOCK_REALTIME由vDSO提供，不陷入内核，
+            // 只在格式化时再转换成可读时间
+            static int64_t NowNs() {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            }
         };
         class File {
         public:
@@ -0,0 +1,386 @@
+/*工作窃取线程池：每个工作线程一个无锁双端队列，空闲线程从其他线程队列顶部窃取任务*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 只可移动的任务类型，小于kInline的可调用对象直接存放在对象内部，不额外分配内存
+class Task {
+public:
+    static constexpr size_t kInline = 64;
+
+    Task() = default;
+    template <class F, class = typename std::enable_if<
+                           !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f) {
+        using Fn = typename std::decay<F>::type;
+        if constexpr (sizeof(Fn) <= kInline && alignof(Fn) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<Fn>::value) {
+            new (buf_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::ops;
+        } else {
+            *reinterpret_cast<Fn **>(buf_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+    Task(Task &&other) noexcept { MoveFrom(other); }
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() { Reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(buf_); }
+
+    void Reset() {
+        if (ops_) {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void *);
+        void (*destroy)(void *);
+        void (*move)(void *dst, void *src); // 移动后销毁src
+    };
+    template <class Fn>
+    struct InlineOps {
+        static void Invoke(void *p) { (*static_cast<Fn *>(p))(); }
+        static void Destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+        static void Move(void *dst, void *src) {
+            new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+        }
+        static constexpr Ops ops = {Invoke, Destroy, Move};
+    };
+    template <class Fn>
+    struct HeapOps {
+        static void Invoke(void *p) { (**static_cast<Fn **>(p))(); }
+        static void Destroy(void *p) { delete *static_cast<Fn **>(p); }
+        static void Move(void *dst, void *src) { *static_cast<Fn **>(dst) = *static_cast<Fn **>(src); }
+        static constexpr Ops ops = {Invoke, Destroy, Move};
+    };
+
+    void MoveFrom(Task &other) {
+        ops_ = other.ops_;
+        if (ops_) {
+            ops_->move(buf_, other.buf_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char buf_[kInline];
+    const Ops *ops_ = nullptr;
+};
+
+// Chase-Lev无锁双端队列，定长。所有者在底部Push/Pop，其他线程在顶部Steal
+template <class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity) : top_(0), bottom_(0) {
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        mask_ = cap - 1;
+        items_ = std::vector<std::atomic<T *>>(cap);
+    }
+
+    // 仅所有者调用，队列满时返回false
+    bool Push(T *item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > static_cast<int64_t>(mask_))
+            return false;
+        items_[b & mask_].store(item, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release); // 窃取者acquire读到新的bottom_后能看到任务内容
+        return true;
+    }
+
+    // 仅所有者调用，后进先出
+    T *Pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) { // 队列为空
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = items_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b) { // 最后一个元素，与窃取者竞争
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用，先进先出
+    T *Steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        T *item = items_[t & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    size_t mask_;
+    std::vector<std::atomic<T *>> items_;
+};
+
+// 工作线程内提交的任务进本线程的双端队列，其他线程(如reactor)提交的进共享的注入队列，
+// 注入队列是节点自身串成的链表，只在一把锁下改两个指针。
+// 任务节点在各线程间回收复用，submit的可调用对象能放进Task内部时，稳定后提交不再分配内存；
+// enqueue还要为返回的future分配共享状态
+class WorkStealingPool {
+public:
+    // local_capacity: 每个工作线程本地队列的容量，满了之后进入注入队列
+    explicit WorkStealingPool(size_t threads, size_t local_capacity = 4096)
+        : stop_(false), pending_(0), sleepers_(0) {
+        if (threads == 0)
+            threads = 1;
+        for (size_t i = 0; i < threads; ++i)
+            locals_.emplace_back(new WorkStealingDeque<Node>(local_capacity));
+        for (size_t i = 0; i < threads; ++i)
+            workers_.emplace_back([this, i] { WorkerLoop(i); });
+    }
+    ~WorkStealingPool() {
+        {
+            std::unique_lock<std::mutex> lock(inject_mutex_);
+            stop_ = true;
+        }
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+        }
+        sleep_cond_.notify_all();
+        for (std::thread &worker : workers_)
+            worker.join();
+    }
+
+    // 提交任务，不关心返回值。任务抛出的异常被丢弃，和ThreadPool中没人取的future一样。
+    // 池已停止时抛出std::runtime_error
+    template <class F>
+    void submit(F &&f) {
+        Node *node = NewNode();
+        node->task = Task(std::forward<F>(f));
+        Schedule(node);
+    }
+
+    // 与ThreadPool::enqueue用法一致，packaged_task直接存放在Task中
+    template <class F, class... Args>
+    auto enqueue(F &&f, Args &&...args)
+        -> std::future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+        std::packaged_task<return_type()> task(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> res = task.get_future();
+        submit(std::move(task));
+        return res;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+private:
+    struct Node {
+        Task task;
+        Node *next = nullptr;       // 所在的缓存或注入队列中的下一个
+        Node *next_batch = nullptr; // 备用链表中下一批的第一个节点
+    };
+
+    // 单链表，用于各线程的节点缓存
+    struct NodeList {
+        Node *head = nullptr;
+        size_t count = 0;
+        void Push(Node *n) {
+            n->next = head;
+            head = n;
+            ++count;
+        }
+        Node *Pop() {
+            Node *n = head;
+            if (n) {
+                head = n->next;
+                --count;
+            }
+            return n;
+        }
+    };
+    struct NodeCache : NodeList {
+        ~NodeCache() {
+            while (Node *n = Pop())
+                delete n;
+        }
+    };
+
+    // 任务多由外部线程提交、在工作线程执行完，节点总是落在工作线程的缓存里。
+    // 缓存超过kNodeCacheMax时整批kNodeBatch个还到全局的备用链表，
+    // 外部线程缓存空了再从那里整批取回，每kNodeBatch个任务才加一次这把锁
+    static constexpr size_t kNodeBatch = 256;
+    static constexpr size_t kNodeCacheMax = 4 * kNodeBatch;
+    struct Spare {
+        std::mutex mutex;
+        Node *batches = nullptr; // 每批用next串起，批与批之间用第一个节点的next_batch串起
+    };
+    static Spare &Spares() {
+        static Spare *spare = new Spare; // 不析构：线程退出时的缓存析构可能晚于静态对象
+        return *spare;
+    }
+    static NodeCache &Cache() {
+        thread_local NodeCache cache;
+        return cache;
+    }
+    static Node *NewNode() {
+        NodeCache &cache = Cache();
+        if (!cache.head) {
+            Spare &spare = Spares();
+            std::unique_lock<std::mutex> lock(spare.mutex);
+            if (Node *batch = spare.batches) {
+                spare.batches = batch->next_batch;
+                lock.unlock();
+                cache.head = batch;
+                cache.count = kNodeBatch;
+            }
+        }
+        if (Node *n = cache.Pop())
+            return n;
+        return new Node;
+    }
+    static void FreeNode(Node *n) {
+        n->task.Reset();
+        NodeCache &cache = Cache();
+        cache.Push(n);
+        if (cache.count <= kNodeCacheMax)
+            return;
+        Node *batch = cache.head, *last = batch;
+        for (size_t i = 1; i < kNodeBatch; ++i)
+            last = last->next;
+        cache.head = last->next;
+        cache.count -= kNodeBatch;
+        last->next = nullptr;
+        Spare &spare = Spares();
+        std::unique_lock<std::mutex> lock(spare.mutex);
+        batch->next_batch = spare.batches;
+        spare.batches = batch;
+    }
+
+    // 当前线程若是本池的工作线程，返回其编号，否则返回-1
+    struct WorkerId {
+        const WorkStealingPool *pool = nullptr;
+        size_t index = 0;
+    };
+    static WorkerId &Self() {
+        thread_local WorkerId id;
+        return id;
+    }
+
+    void Schedule(Node *node) {
+        WorkerId &self = Self();
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+        if (self.pool != this || !locals_[self.index]->Push(node)) {
+            std::unique_lock<std::mutex> lock(inject_mutex_);
+            if (stop_) {
+                lock.unlock();
+                pending_.fetch_sub(1);
+                FreeNode(node);
+                throw std::runtime_error("submit on stopped WorkStealingPool");
+            }
+            node->next = nullptr;
+            if (inject_tail_)
+                inject_tail_->next = node;
+            else
+                inject_head_ = node;
+            inject_tail_ = node;
+        }
+        if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cond_.notify_one();
+        }
+    }
+
+    Node *PopInjected() {
+        std::unique_lock<std::mutex> lock(inject_mutex_);
+        Node *n = inject_head_;
+        if (n) {
+            inject_head_ = n->next;
+            if (!inject_head_)
+                inject_tail_ = nullptr;
+        }
+        return n;
+    }
+
+    Node *StealFromOthers(size_t self) {
+        size_t n = locals_.size();
+        for (size_t i = 1; i < n; ++i) {
+            Node *node = locals_[(self + i) % n]->Steal();
+            if (node)
+                return node;
+        }
+        return nullptr;
+    }
+
+    void WorkerLoop(size_t index) {
+        Self().pool = this;
+        Self().index = index;
+        for (;;) {
+            Node *node = locals_[index]->Pop();
+            if (!node)
+                node = PopInjected();
+            if (!node)
+                node = StealFromOthers(index);
+            if (node) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                try {
+                    node->task();
+                } catch (...) {
+                }
+                FreeNode(node);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            sleep_cond_.wait(lock, [this] {
+                return stop_ || pending_.load(std::memory_order_seq_cst) > 0;
+            });
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            if (stop_ && pending_.load() == 0)
+                return;
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkStealingDeque<Node>>> locals_; // 每个工作线程的本地队列
+    std::vector<std::thread> workers_;
+    Node *inject_head_ = nullptr; // 外部线程提交的任务，先进先出
+    Node *inject_tail_ = nullptr;
+    std::mutex inject_mutex_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cond_;
+    std::atomic<bool> stop_;
+    std::atomic<size_t> pending_;  // 所有队列中尚未取走的任务数
+    std::atomic<size_t> sleepers_; // 正在等待任务的工作线程数
+};
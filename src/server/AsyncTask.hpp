@@ -0,0 +1,277 @@
+#pragma once
+#include "Util.hpp"
+#include "../../log_system/logs_code/WorkStealingPool.hpp"
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/http_struct.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 异步处理模型：事件回调只解析请求，把阻塞的文件/压缩/持久化工作交给工作线程池(WorkStealingPool)，
+// 工作完成后通过event_active回到请求所属的event_base上发送响应。
+// 客户端提前断开时不再发送，由连接的closecb标记取消
+namespace storage
+{
+    // 工作线程填写的响应，工作线程中不能访问evhttp_request
+    struct HttpReply
+    {
+        // 流式响应体：在工作线程中逐段生成，chunk为空表示结束，返回false表示出错(直接断开连接)。
+        // headers中没有Content-Length时，HTTP/1.1的请求按chunked编码发送
+        using Producer = std::function<bool(std::string *chunk)>;
+        // 文件的一个片段，发送前先发head；offset相对于[offset, offset+length)的起点
+        struct Part
+        {
+            std::string head;
+            ev_off_t offset;
+            ev_off_t length;
+        };
+
+        int code = HTTP_OK;
+        std::string reason;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+        int fd = -1;         // 不为-1时把文件[offset, offset+length)追加为响应体，发送后由evbuffer关闭
+        ev_off_t offset = 0;
+        ev_off_t length = 0;
+        std::vector<Part> parts;          // fd有效且不为空时按顺序只发送这些片段(multipart/byteranges)
+        std::shared_ptr<const void> hold; // 文件发送完或连接释放之前一直持有，例如解压缓存的引用
+        Producer producer;                // 不为空时忽略body和fd
+
+        void AddHeader(const std::string &key, const std::string &value) {
+            headers.emplace_back(key, value);
+        }
+    };
+
+    class AsyncTask
+    {
+    public:
+        using Work = std::function<void(HttpReply *)>;
+
+        // 在事件循环线程调用，work在pool中执行
+        static void Run(WorkStealingPool *pool, evhttp_request *req, Work work) {
+            evhttp_connection *evcon = evhttp_request_get_connection(req);
+            AsyncTask *task = new AsyncTask(pool, req, evcon, std::move(work));
+            task->done_ev_ = event_new(evhttp_connection_get_base(evcon), -1, 0, OnDone, task);
+            // 同一连接上evhttp一次只处理一个请求，closecb可以直接归这个任务使用
+            evhttp_connection_set_closecb(evcon, OnClose, task);
+            task->busy_ = true;
+            try
+            {
+                pool->submit([task]()
+                             { task->Execute(); });
+            }
+            catch (const std::runtime_error &e)
+            {
+                task->reply_.code = HTTP_SERVUNAVAIL;
+                event_active(task->done_ev_, 0, 0);
+            }
+        }
+
+        // 在事件循环线程发送响应
+        static void Send(evhttp_request *req, HttpReply *reply) {
+            evbuffer *out = evhttp_request_get_output_buffer(req);
+            if (!reply->body.empty())
+                evbuffer_add(out, reply->body.data(), reply->body.size());
+            if (reply->fd != -1)
+            {
+                // 和evbuffer_add_file一样走sendfile/mmap，但可以在文件段释放时得到通知
+                evbuffer_file_segment *seg = evbuffer_file_segment_new(reply->fd, reply->offset, reply->length,
+                                                                       EVBUF_FS_CLOSE_ON_FREE);
+                if (seg == NULL)
+                {
+                    mylog::GetLogger("asynclogger")->Warn("evbuffer_file_segment_new: %d -- %s", reply->fd, strerror(errno));
+                    close(reply->fd);
+                }
+                else
+                {
+                    if (reply->hold)
+                        evbuffer_file_segment_add_cleanup_cb(seg, ReleaseHold, new std::shared_ptr<const void>(std::move(reply->hold)));
+                    if (reply->parts.empty())
+                        AddSegment(out, seg, 0, reply->length);
+                    for (auto &p : reply->parts)
+                    {
+                        evbuffer_add(out, p.head.data(), p.head.size());
+                        if (p.length > 0)
+                            AddSegment(out, seg, p.offset, p.length);
+                    }
+                    evbuffer_file_segment_free(seg); // 交给evbuffer持有
+                }
+                reply->fd = -1;
+            }
+            AddHeaders(req, reply);
+            evhttp_send_reply(req, reply->code, reply->reason.empty() ? NULL : reply->reason.c_str(), NULL);
+        }
+
+    private:
+        static void ReleaseHold(evbuffer_file_segment const *, int, void *arg) {
+            delete static_cast<std::shared_ptr<const void> *>(arg);
+        }
+
+        // 同一个文件段可以多次引用，数据不经过用户态拷贝
+        static void AddSegment(evbuffer *out, evbuffer_file_segment *seg, ev_off_t offset, ev_off_t length) {
+            if (evbuffer_add_file_segment(out, seg, offset, length) == -1)
+                mylog::GetLogger("asynclogger")->Warn("evbuffer_add_file_segment: %s", strerror(errno));
+        }
+
+        static void AddHeaders(evhttp_request *req, HttpReply *reply) {
+            for (auto &h : reply->headers)
+                evhttp_add_header(evhttp_request_get_output_headers(req), h.first.c_str(), h.second.c_str());
+        }
+
+        AsyncTask(WorkStealingPool *pool, evhttp_request *req, evhttp_connection *evcon, Work work)
+            : pool_(pool), req_(req), evcon_(evcon), work_(std::move(work)) {}
+        ~AsyncTask() {
+            event_free(done_ev_);
+            if (reply_.fd != -1)
+                close(reply_.fd);
+        }
+
+        void Execute() {
+            try
+            {
+                work_(&reply_);
+            }
+            catch (const std::exception &e)
+            {
+                mylog::GetLogger("asynclogger")->Warn("request work failed: %s", e.what());
+                if (reply_.fd != -1)
+                    close(reply_.fd);
+                reply_ = HttpReply();
+                reply_.code = HTTP_INTERNAL;
+            }
+            event_active(done_ev_, 0, 0);
+        }
+
+        // 连接释放时调用，没有工作线程在用本任务时直接销毁
+        static void OnClose(evhttp_connection * /*evcon*/, void *arg) {
+            AsyncTask *task = static_cast<AsyncTask *>(arg);
+            task->cancelled_ = true;
+            if (!task->busy_)
+                delete task;
+        }
+
+        // work执行完或者流式响应生成了一段
+        static void OnDone(evutil_socket_t, short, void *arg) {
+            AsyncTask *task = static_cast<AsyncTask *>(arg);
+            task->busy_ = false;
+            if (task->cancelled_)
+            {
+                mylog::GetLogger("asynclogger")->Info("client closed before reply");
+                delete task;
+            }
+            else if (task->streaming_)
+                task->OnChunk();
+            else if (task->reply_.producer)
+                task->StartStream();
+            else
+            {
+                evhttp_connection_set_closecb(task->evcon_, NULL, NULL);
+                Send(task->req_, &task->reply_);
+                delete task;
+            }
+        }
+
+        ///////////////////////////////////////////
+        // 流式响应：同一时间最多一段在输出缓冲区、一段已生成待发，慢客户端不会让内存无限增长
+        void StartStream() {
+            AddHeaders(req_, &reply_);
+            evhttp_send_reply_start(req_, reply_.code, reply_.reason.empty() ? NULL : reply_.reason.c_str());
+            streaming_ = true;
+            drained_ = true;
+            Produce();
+        }
+
+        void Produce() {
+            busy_ = true;
+            try
+            {
+                pool_->submit([this]()
+                              {
+                    try
+                    {
+                        ok_ = reply_.producer(&chunk_);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        ok_ = false;
+                    }
+                    event_active(done_ev_, 0, 0); });
+            }
+            catch (const std::runtime_error &e)
+            {
+                ok_ = false;
+                event_active(done_ev_, 0, 0);
+            }
+        }
+
+        void OnChunk() {
+            if (!ok_)
+            {
+                // 响应头已经发出，只能断开连接让客户端知道响应体不完整
+                mylog::GetLogger("asynclogger")->Warn("stream body failed, close connection");
+                evhttp_connection_set_closecb(evcon_, NULL, NULL);
+                evhttp_connection_free(evcon_);
+                delete this;
+            }
+            else if (chunk_.empty())
+            {
+                evhttp_connection_set_closecb(evcon_, NULL, NULL);
+                // chunked编码时结束会再写一段"0\r\n\r\n"，写回调可能同步进到OnDrained，不能再处理一次
+                streaming_ = false;
+                evhttp_send_reply_end(req_);
+                delete this;
+            }
+            else if (drained_)
+                SendChunk();
+            // 否则等OnDrained
+        }
+
+        void SendChunk() {
+            evbuffer *buf = evbuffer_new();
+            evbuffer_add(buf, chunk_.data(), chunk_.size());
+            chunk_.clear();
+            drained_ = false;
+            // 先开始生成下一段：写回调可能在send_reply_chunk内部同步触发，此时busy_必须已经为true
+            Produce();
+            evhttp_send_reply_chunk_with_cb(req_, buf, OnDrained, this);
+            evbuffer_free(buf);
+            // 过滤器bufferevent在数据加入时就同步搬走并触发写回调，那时evhttp还没换上OnDrained，
+            // 这一段已经整个交给底层时要自己记为写空
+            if (evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(evcon_))) == 0)
+                drained_ = true;
+        }
+
+        // 输出缓冲区写空
+        static void OnDrained(evhttp_connection *, void *arg) {
+            AsyncTask *task = static_cast<AsyncTask *>(arg);
+            task->drained_ = true;
+            if (task->streaming_ && !task->busy_ && !task->cancelled_)
+                task->OnChunk();
+        }
+
+    private:
+        WorkStealingPool *pool_;
+        evhttp_request *req_;
+        evhttp_connection *evcon_;
+        Work work_;
+        HttpReply reply_;
+        event *done_ev_ = nullptr;
+        // 以下只在事件循环线程中读写
+        bool cancelled_ = false;
+        bool busy_ = false;      // 有工作线程正在使用本任务
+        bool streaming_ = false;
+        bool drained_ = false;
+        // 工作线程写，event_active之后事件循环线程读
+        std::string chunk_;
+        bool ok_ = true;
+    };
+}
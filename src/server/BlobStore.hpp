@@ -0,0 +1,231 @@
+#pragma once
+#include "BlockCompressor.hpp"
+#include "StorageInfo.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// 按内容寻址的blob存储：相同内容的文件在同一个存储目录中只占一份磁盘。
+// <存储目录>/.blobs/<内容哈希>是blob，用户文件<存储目录>/<文件名>是指向它的硬链接，
+// 条目通过StorageInfo::hash_和所在目录找到自己的blob。deep目录中的blob是压缩好的，
+// 相同内容再次上传到deep时直接链接，不再压缩和写盘。
+// 引用计数就是blob文件的链接数，由文件系统和链接/删除操作原子地维护，崩溃后也不会和磁盘不一致；
+// 链接数降到1(只剩.blobs中的名字)时删除blob。下载、解压缓存和删除仍按文件名路径进行，
+// blob名只是查找相同内容用的索引，提前删掉也只是少一次去重，已经链接出去的文件不受影响
+namespace storage
+{
+    class BlobStore
+    {
+    public:
+        static constexpr const char *kBlobDir = ".blobs/";
+        // 上传和链接用的临时文件都放在存储目录中，以它开头，启动时清理上次运行留下的
+        static constexpr const char *kTempPrefix = ".upload.";
+
+        // storage_path所在目录中内容哈希为hash的blob
+        static std::string BlobPath(const std::string &storage_path, uint64_t hash) {
+            return DirOf(storage_path) + kBlobDir + ContentHash::Hex(hash);
+        }
+
+        // storage_path所在目录中当前线程用的临时文件，tag区分同一线程同时要用的几个
+        static std::string TempPath(const std::string &storage_path, const char *tag) {
+            return DirOf(storage_path) + kTempPrefix + tag + "." + std::to_string(pthread_self());
+        }
+
+        // 把写好的临时文件提交为storage_path。已有内容相同的blob时链接到它并删掉临时文件，
+        // 否则临时文件同时成为新的blob。hash为0(未知)或哈希相同而内容不同时只做rename。失败时删除临时文件
+        static bool Commit(const std::string &temp_path, const std::string &storage_path, uint64_t hash) {
+            if (hash != 0)
+            {
+                std::string blob = BlobPath(storage_path, hash);
+                FileUtil(blob.substr(0, blob.find_last_of('/') + 1)).CreateDirectory();
+                // 并发上传同样的内容时只有一个能建成blob，其余的发现EEXIST后按已有blob处理
+                if (link(temp_path.c_str(), blob.c_str()) == 0)
+                {
+                    if (Rename(temp_path, storage_path))
+                        return true;
+                    unlink(blob.c_str());
+                    return false;
+                }
+                if (errno == EEXIST && SameFile(temp_path, blob) && Link(blob, storage_path))
+                {
+                    mylog::GetLogger("asynclogger")->Info("dedup %s -> %s", storage_path.c_str(), blob.c_str());
+                    unlink(temp_path.c_str());
+                    return true;
+                }
+            }
+            return Rename(temp_path, storage_path);
+        }
+
+        // 请求体在内存中时先找内容相同的blob，找到就直接链接，省掉写文件(deep还省掉压缩)。
+        // compressed表示blob是deep目录中分块压缩的格式，此时按块解压后比较
+        static bool LinkExisting(const std::string &storage_path, uint64_t hash, const std::string &content,
+                                 bool compressed) {
+            if (hash == 0)
+                return false;
+            std::string blob = BlobPath(storage_path, hash);
+            if (access(blob.c_str(), F_OK) != 0)
+                return false;
+            bool same = compressed ? SameBlocks(blob, content) : SameContent(blob, content);
+            if (!same || !Link(blob, storage_path))
+                return false;
+            mylog::GetLogger("asynclogger")->Info("dedup %s -> %s", storage_path.c_str(), blob.c_str());
+            return true;
+        }
+
+        // 条目对应的文件已被删除或覆盖，没有其他文件再链接blob时删除它
+        static void Release(const StorageInfo &info) {
+            if (info.hash_ == 0)
+                return;
+            std::string blob = BlobPath(info.storage_path_, info.hash_);
+            struct stat st;
+            if (stat(blob.c_str(), &st) == 0 && st.st_nlink <= 1)
+            {
+                unlink(blob.c_str());
+                mylog::GetLogger("asynclogger")->Info("remove blob %s", blob.c_str());
+            }
+        }
+
+        // 启动时清理dir中上次运行留下的临时文件和没有文件链接的blob。
+        // 在link和rename之间退出时临时文件和blob共用inode，要先删临时文件，blob的链接数才会降到1。
+        // used判断路径是不是表中条目的文件，文件名恰好以临时前缀开头的用户文件不会被删
+        static void Sweep(const std::string &dir, const std::function<bool(const std::string &)> &used) {
+            FileUtil fu(dir);
+            if (!fu.Exists())
+                return;
+            std::vector<std::string> files;
+            fu.ScanDirectory(&files);
+            size_t temps = 0;
+            for (auto &f : files)
+            {
+                // ScanDirectory给出的是relative_path，dir是绝对路径时不能直接用，按目录+文件名重新拼
+                std::string name = FileUtil(f).FileName();
+                std::string path = dir + name;
+                if (name.compare(0, strlen(kTempPrefix), kTempPrefix) == 0 && !used(path) && unlink(path.c_str()) == 0)
+                    ++temps;
+            }
+
+            FileUtil blobs(dir + kBlobDir);
+            files.clear();
+            if (blobs.Exists())
+                blobs.ScanDirectory(&files);
+            size_t removed = 0;
+            for (auto &f : files)
+            {
+                std::string path = dir + kBlobDir + FileUtil(f).FileName();
+                struct stat st;
+                if (stat(path.c_str(), &st) == 0 && st.st_nlink <= 1 && unlink(path.c_str()) == 0)
+                    ++removed;
+            }
+            mylog::GetLogger("asynclogger")->Info("sweep %s: %zu stale temps removed, %zu blobs, %zu unreferenced removed",
+                                                  dir.c_str(), temps, files.size(), removed);
+        }
+
+    private:
+        static std::string DirOf(const std::string &storage_path) {
+            size_t pos = storage_path.find_last_of('/');
+            return pos == std::string::npos ? "" : storage_path.substr(0, pos + 1);
+        }
+
+        static bool Rename(const std::string &temp_path, const std::string &storage_path) {
+            if (rename(temp_path.c_str(), storage_path.c_str()) != 0)
+            {
+                mylog::GetLogger("asynclogger")->Error("rename %s -> %s err: %s", temp_path.c_str(),
+                                                       storage_path.c_str(), strerror(errno));
+                unlink(temp_path.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        // 先链接到临时名再rename，原子地替换storage_path
+        static bool Link(const std::string &blob, const std::string &storage_path) {
+            std::string temp = TempPath(storage_path, "link");
+            unlink(temp.c_str());
+            if (link(blob.c_str(), temp.c_str()) != 0)
+            {
+                mylog::GetLogger("asynclogger")->Warn("link %s -> %s err: %s", blob.c_str(), temp.c_str(), strerror(errno));
+                return false;
+            }
+            bool ok = rename(temp.c_str(), storage_path.c_str()) == 0;
+            // storage_path已经链接着同一个blob时rename什么都不做，临时名要自己删
+            unlink(temp.c_str());
+            return ok;
+        }
+
+        // 哈希相同还要逐字节确认，哈希碰撞时不能把别人的内容当成自己的
+        static bool SameFile(const std::string &a, const std::string &b) {
+            int fa = open(a.c_str(), O_RDONLY);
+            int fb = open(b.c_str(), O_RDONLY);
+            struct stat sa, sb;
+            bool same = fa != -1 && fb != -1 && fstat(fa, &sa) == 0 && fstat(fb, &sb) == 0 &&
+                        sa.st_size == sb.st_size;
+            std::string ba(kChunk, '\0'), bb(kChunk, '\0');
+            for (off_t off = 0; same && off < sa.st_size; off += kChunk)
+            {
+                size_t len = std::min<off_t>(kChunk, sa.st_size - off);
+                same = ReadAt(fa, &ba[0], len, off) && ReadAt(fb, &bb[0], len, off) &&
+                       memcmp(ba.data(), bb.data(), len) == 0;
+            }
+            if (fa != -1)
+                close(fa);
+            if (fb != -1)
+                close(fb);
+            return same;
+        }
+
+        static bool SameContent(const std::string &blob, const std::string &content) {
+            int fd = open(blob.c_str(), O_RDONLY);
+            struct stat st;
+            bool same = fd != -1 && fstat(fd, &st) == 0 && (size_t)st.st_size == content.size();
+            std::string buf(kChunk, '\0');
+            for (size_t off = 0; same && off < content.size(); off += kChunk)
+            {
+                size_t len = std::min(kChunk, content.size() - off);
+                same = ReadAt(fd, &buf[0], len, off) && memcmp(buf.data(), content.data() + off, len) == 0;
+            }
+            if (fd != -1)
+                close(fd);
+            return same;
+        }
+
+        // 解压比压缩快得多，确认内容相同后就不必再压缩一遍
+        static bool SameBlocks(const std::string &blob, const std::string &content) {
+            BlockReader reader;
+            if (!reader.Open(blob) || reader.RawSize() != content.size())
+                return false;
+            std::string raw;
+            for (size_t i = 0; i < reader.BlockCount(); ++i)
+            {
+                uint64_t start = reader.BlockStart(i);
+                if (!reader.ReadBlock(i, &raw) || content.compare(start, raw.size(), raw) != 0)
+                    return false;
+            }
+            return true;
+        }
+
+        static bool ReadAt(int fd, char *buf, size_t len, off_t off) {
+            while (len > 0)
+            {
+                ssize_t n = pread(fd, buf, len, off);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                buf += n;
+                len -= n;
+                off += n;
+            }
+            return true;
+        }
+
+        static constexpr size_t kChunk = 1024 * 1024;
+    };
+}
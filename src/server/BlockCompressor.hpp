@@ -0,0 +1,280 @@
+#pragma once
+#include "Util.hpp"
+#include "../../log_system/logs_code/WorkStealingPool.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 上传请求体的边收边写：事件循环把请求体切成块交给本类，
+// 块在服务的工作线程池中按到达顺序压缩(深度存储)或原样(普通存储)追加到文件，事件循环不执行任何磁盘写入和压缩。
+// 文件末尾带块索引，BlockReader据此只解压某个区间涉及的块
+namespace storage
+{
+    // 把块依次压缩写入fd，Finish时写入结束标记、块索引和尾部，格式见FileUtil::kBlockMagic
+    class BlockEncoder
+    {
+    public:
+        // 不接管fd，写入文件头
+        BlockEncoder(int fd, int format) : fd_(fd), format_(format) {
+            good_ = WriteAll(fd_, FileUtil::kBlockMagic, FileUtil::kBlockMagicLen);
+            offset_ = FileUtil::kBlockMagicLen;
+        }
+
+        bool Append(const char *data, size_t len) {
+            if (!good_ || len == 0)
+                return good_;
+            std::string packed = bundle::pack(format_, std::string(data, len));
+            uint32_t plen = packed.size();
+            index_.push_back(FileUtil::BlockIndexEntry{offset_, (uint32_t)len});
+            good_ = WriteAll(fd_, (const char *)&plen, sizeof(plen)) && WriteAll(fd_, packed.data(), packed.size());
+            offset_ += sizeof(plen) + packed.size();
+            return good_;
+        }
+
+        bool Finish() {
+            if (!good_)
+                return false;
+            uint32_t end = 0;
+            uint64_t index_offset = offset_ + sizeof(end);
+            uint32_t count = index_.size();
+            std::string tail((const char *)&end, sizeof(end));
+            tail.append((const char *)index_.data(), index_.size() * sizeof(FileUtil::BlockIndexEntry));
+            tail.append((const char *)&index_offset, sizeof(index_offset));
+            tail.append((const char *)&count, sizeof(count));
+            tail.append(FileUtil::kBlockIndexMagic, FileUtil::kBlockMagicLen);
+            good_ = WriteAll(fd_, tail.data(), tail.size());
+            return good_;
+        }
+
+        bool Good() const { return good_; }
+
+        static bool WriteAll(int fd, const char *data, size_t len) {
+            while (len > 0)
+            {
+                ssize_t n = write(fd, data, len);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    mylog::GetLogger("asynclogger")->Warn("block write err: %s", strerror(errno));
+                    return false;
+                }
+                data += n;
+                len -= n;
+            }
+            return true;
+        }
+
+    private:
+        int fd_;
+        int format_;
+        bool good_;
+        uint64_t offset_;
+        std::vector<FileUtil::BlockIndexEntry> index_;
+    };
+
+    // 按块索引随机读取深度存储文件，没有索引的旧文件Open返回false
+    class BlockReader
+    {
+    public:
+        ~BlockReader() {
+            if (fd_ != -1)
+                close(fd_);
+        }
+
+        bool Open(const std::string &path) {
+            fd_ = open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd_ == -1 || fstat(fd_, &st) == -1)
+                return false;
+            const size_t trailer = sizeof(uint64_t) + sizeof(uint32_t) + FileUtil::kBlockMagicLen;
+            if ((uint64_t)st.st_size < FileUtil::kBlockMagicLen + trailer)
+                return false;
+            char buf[trailer];
+            if (!ReadAt(buf, trailer, st.st_size - trailer) ||
+                memcmp(buf + trailer - FileUtil::kBlockMagicLen, FileUtil::kBlockIndexMagic, FileUtil::kBlockMagicLen) != 0)
+                return false;
+            uint64_t index_offset;
+            uint32_t count;
+            memcpy(&index_offset, buf, sizeof(index_offset));
+            memcpy(&count, buf + sizeof(index_offset), sizeof(count));
+            if (index_offset + (uint64_t)count * sizeof(FileUtil::BlockIndexEntry) + trailer != (uint64_t)st.st_size)
+                return false;
+            index_.resize(count);
+            if (count > 0 && !ReadAt((char *)index_.data(), count * sizeof(FileUtil::BlockIndexEntry), index_offset))
+                return false;
+            index_end_ = index_offset - sizeof(uint32_t);
+            starts_.resize(count + 1);
+            starts_[0] = 0;
+            for (uint32_t i = 0; i < count; ++i)
+                starts_[i + 1] = starts_[i] + index_[i].raw_len;
+            return true;
+        }
+
+        // 解压前的文件大小
+        uint64_t RawSize() const { return starts_.empty() ? 0 : starts_.back(); }
+        size_t BlockCount() const { return index_.size(); }
+        // 包含解压后偏移pos的块
+        size_t FindBlock(uint64_t pos) const {
+            return std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin() - 1;
+        }
+        uint64_t BlockStart(size_t i) const { return starts_[i]; }
+
+        // 解压第i块
+        bool ReadBlock(size_t i, std::string *raw) {
+            uint64_t off = index_[i].offset;
+            uint64_t next = i + 1 < index_.size() ? index_[i + 1].offset : index_end_;
+            if (next <= off + sizeof(uint32_t))
+                return false;
+            std::string packed(next - off - sizeof(uint32_t), '\0');
+            if (!ReadAt(&packed[0], packed.size(), off + sizeof(uint32_t)))
+                return false;
+            *raw = bundle::unpack(packed);
+            return raw->size() == index_[i].raw_len;
+        }
+
+    private:
+        bool ReadAt(char *buf, size_t len, uint64_t off) {
+            while (len > 0)
+            {
+                ssize_t n = pread(fd_, buf, len, off);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                buf += n;
+                len -= n;
+                off += n;
+            }
+            return true;
+        }
+
+    private:
+        int fd_ = -1;
+        uint64_t index_end_ = 0; // 结束标记的位置，最后一块到此为止
+        std::vector<FileUtil::BlockIndexEntry> index_;
+        std::vector<uint64_t> starts_; // 每块解压后的起始偏移，最后一项为总大小
+    };
+
+    class BlockWriter : public std::enable_shared_from_this<BlockWriter>
+    {
+    public:
+        using ptr = std::shared_ptr<BlockWriter>;
+        static constexpr size_t kMaxPending = 4; // 积压超过该块数时调用方应暂停读socket
+        static constexpr int kRaw = -1;          // format为kRaw时块原样追加，不压缩
+
+        // 接管fd，压缩时写入文件头；块在pool中压缩和写入
+        BlockWriter(int fd, int format, WorkStealingPool *pool) : fd_(fd), pool_(pool) {
+            if (format != kRaw)
+            {
+                encoder_.reset(new BlockEncoder(fd, format));
+                failed_ = !encoder_->Good();
+            }
+        }
+        ~BlockWriter() {
+            if (fd_ != -1)
+                close(fd_);
+        }
+
+        // 积压减少或全部写完时在后台线程调用，用于唤醒事件循环
+        void SetNotify(std::function<void()> notify) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            notify_ = std::move(notify);
+        }
+
+        // 提交一个块，返回false表示积压已满
+        bool Submit(std::string block) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            queue_.push_back(std::move(block));
+            StartLocked();
+            return queue_.size() < kMaxPending;
+        }
+        // 请求体已经收完，剩余的块写完后Done()变为true
+        void Finish() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            finished_ = true;
+            StartLocked();
+        }
+        // 连接断开，丢弃尚未压缩的块
+        void Abort() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            queue_.clear();
+            notify_ = nullptr;
+        }
+
+        bool Done() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return done_;
+        }
+        bool Failed() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return failed_;
+        }
+        size_t Pending() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return queue_.size();
+        }
+
+    private:
+        // 同一时间只有一个后台任务在处理本文件的块，保证写入顺序
+        void StartLocked() {
+            if (running_)
+                return;
+            running_ = true;
+            auto self = shared_from_this();
+            pool_->submit([self]()
+                          { self->Drain(); });
+        }
+
+        void Drain() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            while (!queue_.empty())
+            {
+                std::string block = std::move(queue_.front());
+                queue_.pop_front();
+                bool failed = failed_;
+                lock.unlock();
+                if (!failed)
+                    failed = encoder_ ? !encoder_->Append(block.data(), block.size())
+                                      : !BlockEncoder::WriteAll(fd_, block.data(), block.size());
+                lock.lock();
+                failed_ = failed_ || failed;
+                if (queue_.size() < kMaxPending && notify_)
+                    notify_();
+            }
+            running_ = false;
+            if (finished_ && !done_)
+            {
+                // 写入结束标记、块索引和尾部
+                if (!failed_ && encoder_ && !encoder_->Finish())
+                    failed_ = true;
+                close(fd_);
+                fd_ = -1;
+                done_ = true;
+                if (notify_)
+                    notify_();
+            }
+        }
+
+    private:
+        int fd_;
+        WorkStealingPool *pool_;
+        std::unique_ptr<BlockEncoder> encoder_; // 为空时不压缩；只在Drain中使用，同一时间只有一个Drain
+        std::mutex mtx_;
+        std::deque<std::string> queue_;
+        std::function<void()> notify_;
+        bool running_ = false;
+        bool finished_ = false;
+        bool done_ = false;
+        bool failed_ = false;
+    };
+}
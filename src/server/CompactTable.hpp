@@ -0,0 +1,525 @@
+#pragma once
+#include "OrderIndex.hpp"
+#include "StorageInfo.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 省内存的文件信息表，用于千万级文件的元数据常驻内存：
+// 1. URL和存储路径都拆成"目录前缀+文件名"，前缀去重后条目里只存1字节编号；
+//    路径的文件名和URL的文件名相同时(URL就是download_prefix_+文件名)两者共用一份字节
+// 2. 字符串都存放在一块连续的arena中，条目只记录偏移和长度
+// 3. 条目定长40字节放在数组里，按URL和按路径的两个开放寻址索引只存条目下标
+// 4. 文件列表用的按URL、修改时间、大小三种顺序的有序索引(见OrderIndex)也只存条目下标，每条12~18字节
+// 不加锁，由调用方保证同步
+namespace storage
+{
+    class CompactTable
+    {
+    public:
+        // 有序索引的三种顺序，排序值相同时按URL排
+        enum class Order { NAME, MTIME, SIZE };
+        // 有序索引中的位置
+        struct Key
+        {
+            int64_t value = 0; // 按名字排序时为0
+            std::string url;
+        };
+
+        CompactTable() {
+            prefixes_.emplace_back(); // 0号是空前缀
+            prefix_ids_[""] = 0;
+        }
+
+        void Reserve(size_t n) {
+            records_.reserve(n);
+            if (n > records_.size())
+                Rehash(n);
+        }
+
+        size_t Size() const { return records_.size(); }
+
+        // URL和存储路径都不超过65535字节的条目才放得进表(前缀编号用完时整串存进arena)。
+        // 调用方在加锁之前检查，Put就不会在持锁时因为名字过长抛出异常
+        static bool Fits(const StorageInfo &info) {
+            return info.url_.size() <= kMaxLength && info.storage_path_.size() <= kMaxLength;
+        }
+
+        // 插入或覆盖，覆盖时返回true，old不为空时带回被覆盖的信息
+        bool Put(const StorageInfo &info, StorageInfo *old = nullptr) {
+            Grow();
+            Record r;
+            r.fsize = info.fsize_;
+            r.hash = info.hash_;
+            r.mtime = PackTime(info.mtime_);
+            r.atime = PackTime(info.atime_);
+            r.url = AddString(info.url_, kNoRef);
+            r.path = AddString(info.storage_path_, r.url);
+
+            uint32_t idx = Find(url_index_, info.url_, &Record::url);
+            bool replaced = idx != kNone;
+            if (replaced)
+            {
+                // 覆盖：旧条目从路径索引中摘掉，旧字符串成为垃圾。
+                // URL不变，按名字的位置不动，按修改时间和大小的要重新放
+                if (old != nullptr)
+                    Decode(records_[idx], old);
+                RemoveSlot(path_index_, records_[idx].path, idx);
+                OrderErase(Order::MTIME, idx);
+                OrderErase(Order::SIZE, idx);
+                garbage_ += StringBytes(records_[idx]);
+                records_[idx] = r;
+                InsertSlot(path_index_, HashKey(info.storage_path_), idx);
+                OrderInsert(Order::MTIME, idx);
+                OrderInsert(Order::SIZE, idx);
+            }
+            else
+            {
+                idx = records_.size();
+                records_.push_back(r);
+                InsertSlot(url_index_, HashKey(info.url_), idx);
+                InsertSlot(path_index_, HashKey(info.storage_path_), idx);
+                for (Order o : kOrders)
+                    OrderInsert(o, idx);
+            }
+            MaybeCompactArena();
+            return replaced;
+        }
+
+        bool Get(const std::string &url, StorageInfo *info) const {
+            uint32_t idx = Find(url_index_, url, &Record::url);
+            if (idx == kNone)
+                return false;
+            Decode(records_[idx], info);
+            return true;
+        }
+
+        bool GetByPath(const std::string &path, StorageInfo *info) const {
+            uint32_t idx = Find(path_index_, path, &Record::path);
+            if (idx == kNone)
+                return false;
+            Decode(records_[idx], info);
+            return true;
+        }
+
+        // 删除url对应的条目，old不为空时带回被删除的信息
+        bool Erase(const std::string &url, StorageInfo *old) {
+            uint32_t idx = Find(url_index_, url, &Record::url);
+            if (idx == kNone)
+                return false;
+            if (old != nullptr)
+                Decode(records_[idx], old);
+            RemoveSlot(url_index_, records_[idx].url, idx);
+            RemoveSlot(path_index_, records_[idx].path, idx);
+            for (Order o : kOrders)
+                OrderErase(o, idx);
+            garbage_ += StringBytes(records_[idx]);
+            // 用最后一个条目填补空位，数组保持紧凑
+            uint32_t last = records_.size() - 1;
+            if (idx != last)
+            {
+                Retarget(url_index_, records_[last].url, last, idx);
+                Retarget(path_index_, records_[last].path, last, idx);
+                if (ordered_)
+                    for (Order o : kOrders)
+                        orders_[int(o)].Retarget(last, idx, Less(o));
+                records_[idx] = records_[last];
+            }
+            records_.pop_back();
+            MaybeCompactArena();
+            return true;
+        }
+
+        void ForEach(const std::function<void(const StorageInfo &)> &fn) const {
+            StorageInfo info;
+            for (auto &r : records_)
+            {
+                Decode(r, &info);
+                fn(info);
+            }
+        }
+
+        // 建立有序索引，之后Put/Erase同步维护。批量加载时整体排序比逐条插入快，
+        // 所以先不建，加载完再调用这里一次排好。没建之前Scan什么也取不到
+        void BuildOrders() {
+            std::vector<uint32_t> v(records_.size());
+            for (Order o : kOrders)
+            {
+                for (uint32_t i = 0; i < v.size(); ++i)
+                    v[i] = i;
+                std::sort(v.begin(), v.end(), Less(o));
+                orders_[int(o)].Build(v);
+            }
+            ordered_ = true;
+        }
+
+        // 按order从after之后(after为空时从头)取URL以prefix开头的条目放进out，最多limit条。
+        // 按名字排序时前缀内的URL是连续的一段；按修改时间/大小时不连续，最多检查budget条，
+        // 因此没检查完就停下时返回true，stop为最后检查的位置
+        bool Scan(Order order, bool desc, const Key *after, const std::string &prefix, size_t limit, size_t budget,
+                  std::vector<StorageInfo> *out, Key *stop) const {
+            using Pos = OrderIndex::Pos;
+            const OrderIndex &index = orders_[int(order)];
+            auto cmp = [this, order](const Key &key)
+            {
+                return [this, order, &key](uint32_t idx)
+                { return CompareKey(order, idx, key); };
+            };
+            // 要遍历的范围[begin, end)
+            Pos begin = index.Begin(), end = index.End();
+            if (after != nullptr)
+            {
+                if (desc)
+                    end = index.Lower(cmp(*after));
+                else
+                    begin = index.Upper(cmp(*after));
+            }
+            if (order == Order::NAME)
+            {
+                Key from{0, prefix};
+                Pos p = index.Lower(cmp(from));
+                if (OrderIndex::Before(begin, p))
+                    begin = p;
+                Key to{0, PrefixEnd(prefix)};
+                if (!to.url.empty())
+                {
+                    p = index.Lower(cmp(to));
+                    if (OrderIndex::Before(p, end))
+                        end = p;
+                }
+            }
+            size_t scanned = 0;
+            StorageInfo info;
+            while (OrderIndex::Before(begin, end))
+            {
+                uint32_t idx;
+                if (desc)
+                {
+                    index.Prev(&end);
+                    idx = index.At(end);
+                }
+                else
+                {
+                    idx = index.At(begin);
+                    index.Next(&begin);
+                }
+                const Record &r = records_[idx];
+                if (HasPrefix(r.url, prefix))
+                {
+                    Decode(r, &info);
+                    out->push_back(info);
+                    if (out->size() >= limit)
+                        return false;
+                }
+                if (++scanned >= budget && OrderIndex::Before(begin, end))
+                {
+                    stop->value = OrderValue(order, r);
+                    stop->url = Expand(r.url);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // 表自身占用的堆内存(按容量计)
+        size_t MemoryBytes() const {
+            size_t n = records_.capacity() * sizeof(Record) + arena_.capacity() +
+                       (url_index_.slots.capacity() + path_index_.slots.capacity()) * sizeof(uint32_t);
+            for (auto &index : orders_)
+                n += index.MemoryBytes();
+            for (auto &p : prefixes_)
+                n += p.capacity();
+            return n;
+        }
+
+    private:
+        // 字符串引用：低40位arena偏移，中间16位长度，高8位前缀编号
+        using Ref = uint64_t;
+        struct Record
+        {
+            Ref url;
+            Ref path;
+            uint64_t fsize;
+            uint64_t hash;
+            uint32_t mtime; // 秒级时间戳按无符号32位存放，可表示到2106年
+            uint32_t atime;
+        };
+        static_assert(sizeof(Record) == 40, "compact record");
+
+        // 槽位存条目下标+1，0为空槽
+        struct Index
+        {
+            std::vector<uint32_t> slots;
+            size_t tombs = 0;
+        };
+
+        static constexpr uint32_t kNone = 0xFFFFFFFF;
+        static constexpr uint32_t kEmpty = 0;
+        static constexpr uint32_t kTomb = 0xFFFFFFFF;
+        static constexpr Ref kNoRef = ~0ULL;
+        static constexpr size_t kMaxLength = 0xFFFF;
+        static constexpr size_t kMaxPrefixes = 256;
+        static constexpr Order kOrders[] = {Order::NAME, Order::MTIME, Order::SIZE};
+
+        static Ref MakeRef(uint64_t off, uint64_t len, uint64_t prefix) {
+            return off | len << 40 | prefix << 56;
+        }
+        static uint64_t RefOffset(Ref r) { return r & ((1ULL << 40) - 1); }
+        static size_t RefLength(Ref r) { return (r >> 40) & kMaxLength; }
+        static uint8_t RefPrefix(Ref r) { return r >> 56; }
+        static bool SameBytes(Ref a, Ref b) {
+            return RefOffset(a) == RefOffset(b) && RefLength(a) == RefLength(b);
+        }
+
+        static uint32_t PackTime(time_t t) {
+            return t < 0 ? 0 : (t > 0xFFFFFFFFLL ? 0xFFFFFFFF : (uint32_t)t);
+        }
+
+        // 把s存成前缀编号+文件名；文件名和share的字节相同时直接共用
+        Ref AddString(const std::string &s, Ref share) {
+            size_t pos = s.find_last_of('/');
+            size_t cut = pos == std::string::npos ? 0 : pos + 1;
+            int id = Intern(s.substr(0, cut));
+            if (id < 0)
+            {
+                // 前缀编号用完，整串存进arena
+                id = 0;
+                cut = 0;
+            }
+            size_t len = s.size() - cut;
+            if (len > kMaxLength)
+                throw std::length_error("name too long: " + s.substr(0, 64));
+            if (share != kNoRef && RefLength(share) == len &&
+                s.compare(cut, len, arena_, RefOffset(share), len) == 0)
+                return MakeRef(RefOffset(share), len, id);
+            uint64_t off = arena_.size();
+            arena_.append(s, cut, len);
+            return MakeRef(off, len, id);
+        }
+
+        int Intern(const std::string &prefix) {
+            auto it = prefix_ids_.find(prefix);
+            if (it != prefix_ids_.end())
+                return it->second;
+            if (prefixes_.size() >= kMaxPrefixes)
+                return -1;
+            int id = prefixes_.size();
+            prefixes_.push_back(prefix);
+            prefix_ids_[prefix] = id;
+            return id;
+        }
+
+        std::string Expand(Ref r) const {
+            const std::string &prefix = prefixes_[RefPrefix(r)];
+            std::string s;
+            s.reserve(prefix.size() + RefLength(r));
+            s.append(prefix);
+            s.append(arena_, RefOffset(r), RefLength(r));
+            return s;
+        }
+        // 不拼接字符串直接比较
+        bool Equal(Ref r, const std::string &s) const {
+            const std::string &prefix = prefixes_[RefPrefix(r)];
+            size_t len = RefLength(r);
+            return s.size() == prefix.size() + len && s.compare(0, prefix.size(), prefix) == 0 &&
+                   s.compare(prefix.size(), len, arena_, RefOffset(r), len) == 0;
+        }
+        // 不拼接字符串比较r和s，返回值的正负同std::string::compare
+        int Compare(Ref r, const std::string &s) const {
+            const std::string &prefix = prefixes_[RefPrefix(r)];
+            size_t head = std::min(prefix.size(), s.size());
+            int c = prefix.compare(0, head, s, 0, head);
+            if (c != 0)
+                return c;
+            if (s.size() < prefix.size())
+                return 1;
+            c = s.compare(prefix.size(), std::string::npos, arena_, RefOffset(r), RefLength(r));
+            return c < 0 ? 1 : (c > 0 ? -1 : 0);
+        }
+        // URL通常都是同一个前缀，只比文件名
+        int Compare(Ref a, Ref b) const {
+            if (RefPrefix(a) == RefPrefix(b))
+                return arena_.compare(RefOffset(a), RefLength(a), arena_, RefOffset(b), RefLength(b));
+            return Compare(a, Expand(b));
+        }
+        bool HasPrefix(Ref r, const std::string &s) const {
+            const std::string &prefix = prefixes_[RefPrefix(r)];
+            size_t head = std::min(prefix.size(), s.size());
+            if (prefix.compare(0, head, s, 0, head) != 0)
+                return false;
+            if (s.size() <= prefix.size())
+                return true;
+            size_t rest = s.size() - prefix.size();
+            return rest <= RefLength(r) && s.compare(prefix.size(), rest, arena_, RefOffset(r), rest) == 0;
+        }
+        static size_t StringBytes(const Record &r) {
+            return RefLength(r.url) + (SameBytes(r.url, r.path) ? 0 : RefLength(r.path));
+        }
+
+        void Decode(const Record &r, StorageInfo *info) const {
+            info->url_ = Expand(r.url);
+            info->storage_path_ = Expand(r.path);
+            info->fsize_ = r.fsize;
+            info->hash_ = r.hash;
+            info->mtime_ = r.mtime;
+            info->atime_ = r.atime;
+        }
+
+        ///////////////////////////////////////////
+        // 有序索引：每种顺序按(排序值, URL)排列条目下标，URL不重复，位置可以二分查到
+        static int64_t OrderValue(Order order, const Record &r) {
+            return order == Order::MTIME ? r.mtime : (order == Order::SIZE ? (int64_t)r.fsize : 0);
+        }
+        bool Before(Order order, uint32_t a, uint32_t b) const {
+            int64_t va = OrderValue(order, records_[a]), vb = OrderValue(order, records_[b]);
+            if (va != vb)
+                return va < vb;
+            return Compare(records_[a].url, records_[b].url) < 0;
+        }
+        int CompareKey(Order order, uint32_t idx, const Key &key) const {
+            int64_t v = OrderValue(order, records_[idx]);
+            if (v != key.value)
+                return v < key.value ? -1 : 1;
+            return Compare(records_[idx].url, key.url);
+        }
+        struct OrderLess
+        {
+            const CompactTable *table;
+            Order order;
+            bool operator()(uint32_t a, uint32_t b) const { return table->Before(order, a, b); }
+        };
+        OrderLess Less(Order order) const { return OrderLess{this, order}; }
+        void OrderInsert(Order order, uint32_t idx) {
+            if (ordered_)
+                orders_[int(order)].Insert(idx, Less(order));
+        }
+        void OrderErase(Order order, uint32_t idx) {
+            if (ordered_)
+                orders_[int(order)].Erase(idx, Less(order));
+        }
+
+        // 大于所有以prefix开头的字符串的最小字符串，不存在(prefix为空或全是0xFF)时返回空串
+        static std::string PrefixEnd(std::string prefix) {
+            while (!prefix.empty() && (unsigned char)prefix.back() == 0xFF)
+                prefix.pop_back();
+            if (prefix.empty())
+                return std::string();
+            prefix.back() = prefix.back() + 1;
+            return prefix;
+        }
+
+        ///////////////////////////////////////////
+        // 开放寻址索引：线性探测，容量为2的幂，条目加墓碑不超过容量的70%
+        // FNV-1a可以分段计算，前缀和文件名分开存也能得到整串的哈希
+        static uint64_t Hash(const char *data, size_t len, uint64_t h = 14695981039346656037ULL) {
+            for (size_t i = 0; i < len; ++i)
+                h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+            return h;
+        }
+        static uint64_t HashKey(const std::string &key) {
+            return Hash(key.data(), key.size());
+        }
+        uint64_t HashRef(Ref r) const {
+            const std::string &prefix = prefixes_[RefPrefix(r)];
+            return Hash(arena_.data() + RefOffset(r), RefLength(r), HashKey(prefix));
+        }
+
+        uint32_t Find(const Index &index, const std::string &key, Ref Record::*field) const {
+            if (index.slots.empty())
+                return kNone;
+            size_t mask = index.slots.size() - 1;
+            for (size_t i = HashKey(key) & mask;; i = (i + 1) & mask)
+            {
+                uint32_t v = index.slots[i];
+                if (v == kEmpty)
+                    return kNone;
+                if (v != kTomb && Equal(records_[v - 1].*field, key))
+                    return v - 1;
+            }
+        }
+        void InsertSlot(Index &index, uint64_t h, uint32_t idx) {
+            size_t mask = index.slots.size() - 1;
+            size_t i = h & mask;
+            while (index.slots[i] != kEmpty && index.slots[i] != kTomb)
+                i = (i + 1) & mask;
+            if (index.slots[i] == kTomb)
+                --index.tombs;
+            index.slots[i] = idx + 1;
+        }
+        // key对应且值为idx的槽位，调用方保证存在
+        size_t Locate(const Index &index, Ref key, uint32_t idx) const {
+            size_t mask = index.slots.size() - 1;
+            size_t i = HashRef(key) & mask;
+            while (index.slots[i] != idx + 1)
+                i = (i + 1) & mask;
+            return i;
+        }
+        void RemoveSlot(Index &index, Ref key, uint32_t idx) {
+            index.slots[Locate(index, key, idx)] = kTomb;
+            ++index.tombs;
+        }
+        void Retarget(Index &index, Ref key, uint32_t from, uint32_t to) {
+            index.slots[Locate(index, key, from)] = to + 1;
+        }
+
+        // 为再放入一个条目留出空间
+        void Grow() {
+            size_t load = records_.size() + 1 + std::max(url_index_.tombs, path_index_.tombs);
+            if (load * 10 > url_index_.slots.size() * 7)
+                Rehash(records_.size() + 1);
+        }
+        // 重建后装载因子不超过50%，到下次重建之间至少还能放下20%容量的插入或删除
+        void Rehash(size_t n) {
+            size_t cap = 16;
+            while (cap < n * 2)
+                cap <<= 1;
+            for (Index *index : {&url_index_, &path_index_})
+            {
+                std::vector<uint32_t>(cap, kEmpty).swap(index->slots);
+                index->tombs = 0;
+            }
+            for (uint32_t i = 0; i < records_.size(); ++i)
+            {
+                InsertSlot(url_index_, HashRef(records_[i].url), i);
+                InsertSlot(path_index_, HashRef(records_[i].path), i);
+            }
+        }
+
+        // 垃圾超过arena一半时重新拷贝一遍存活的字符串
+        void MaybeCompactArena() {
+            if (garbage_ < 64 * 1024 || garbage_ * 2 < arena_.size())
+                return;
+            std::string arena;
+            arena.reserve(arena_.size() - garbage_);
+            auto move = [&](Ref r)
+            {
+                uint64_t off = arena.size();
+                arena.append(arena_, RefOffset(r), RefLength(r));
+                return MakeRef(off, RefLength(r), RefPrefix(r));
+            };
+            for (auto &r : records_)
+            {
+                bool shared = SameBytes(r.url, r.path);
+                r.url = move(r.url);
+                r.path = shared ? MakeRef(RefOffset(r.url), RefLength(r.url), RefPrefix(r.path)) : move(r.path);
+            }
+            arena_.swap(arena);
+            garbage_ = 0;
+        }
+
+    private:
+        std::vector<Record> records_;
+        Index url_index_;
+        Index path_index_;
+        OrderIndex orders_[3]; // 按kOrders的顺序
+        bool ordered_ = false;
+        std::string arena_;
+        size_t garbage_ = 0; // arena中已不被引用的字节数
+        std::vector<std::string> prefixes_;
+        std::unordered_map<std::string, int> prefix_ids_;
+    };
+}
@@ -17,6 +17,16 @@ namespace storage
         std::string low_storage_dir_;     // 浅度存储文件的存储路径
         std::string storage_info_;     // 已存储文件的信息
         int bundle_format_;//深度存储的文件后缀，由选择的压缩格式确定
+        int service_threads_;          // 处理请求的reactor线程数，0表示按CPU核数
+        size_t upload_buffer_size_;    // 每个上传连接最多缓存的请求体字节数
+        size_t deep_block_size_;       // 深度存储边收边压缩的块大小
+        int worker_threads_;           // 处理文件读写和压缩的工作线程数，0表示按CPU核数
+        std::string cache_dir_;        // 深度存储文件解压缓存的目录
+        uint64_t cache_capacity_;      // 解压缓存的总字节数上限
+        uint64_t journal_max_bytes_;   // 元数据日志超过该大小时压缩成快照
+        int snapshot_interval_;        // 定期压缩元数据日志的间隔(秒)，0表示只按大小压缩
+        std::string snapshot_format_;  // 快照格式：binary或json(便于导出查看)，加载时两种都能识别
+        std::string cache_control_;    // 下载响应的Cache-Control，同名文件可能被覆盖，默认每次用ETag重新验证
     private:
         static std::mutex _mutex;
         static Config *_instance;
@@ -52,6 +62,16 @@ namespace storage
             deep_storage_dir_ = root["deep_storage_dir"].asString();
             low_storage_dir_ = root["low_storage_dir"].asString();
             bundle_format_ = root["bundle_format"].asInt();
+            service_threads_ = root.isMember("service_threads") ? root["service_threads"].asInt() : 1;
+            upload_buffer_size_ = root.isMember("upload_buffer_size") ? root["upload_buffer_size"].asUInt64() : 1024 * 1024;
+            deep_block_size_ = root.isMember("deep_block_size") ? root["deep_block_size"].asUInt64() : 1024 * 1024;
+            worker_threads_ = root.isMember("worker_threads") ? root["worker_threads"].asInt() : 4;
+            cache_dir_ = root.isMember("cache_dir") ? root["cache_dir"].asString() : "./cache/";
+            cache_capacity_ = root.isMember("cache_capacity") ? root["cache_capacity"].asUInt64() : 1024ULL * 1024 * 1024;
+            journal_max_bytes_ = root.isMember("journal_max_bytes") ? root["journal_max_bytes"].asUInt64() : 64ULL * 1024 * 1024;
+            snapshot_interval_ = root.isMember("snapshot_interval") ? root["snapshot_interval"].asInt() : 300;
+            snapshot_format_ = root.isMember("snapshot_format") ? root["snapshot_format"].asString() : "binary";
+            cache_control_ = root.isMember("cache_control") ? root["cache_control"].asString() : "no-cache";
             
             return true;
         }
@@ -76,6 +96,36 @@ namespace storage
         std::string GetStorageInfoFile() {
             return storage_info_;
         }
+        int GetServiceThreads() {
+            return service_threads_;
+        }
+        size_t GetUploadBufferSize() {
+            return upload_buffer_size_;
+        }
+        size_t GetDeepBlockSize() {
+            return deep_block_size_;
+        }
+        int GetWorkerThreads() {
+            return worker_threads_;
+        }
+        std::string GetCacheDir() {
+            return cache_dir_;
+        }
+        uint64_t GetCacheCapacity() {
+            return cache_capacity_;
+        }
+        uint64_t GetJournalMaxBytes() {
+            return journal_max_bytes_;
+        }
+        int GetSnapshotInterval() {
+            return snapshot_interval_;
+        }
+        std::string GetSnapshotFormat() {
+            return snapshot_format_;
+        }
+        std::string GetCacheControl() {
+            return cache_control_;
+        }
 
     public:
         // 获取单例类对象
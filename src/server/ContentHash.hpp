@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// 文件内容哈希：XXH64算法，可以分段喂入，上传时边收数据边计算，不需要再读一遍文件。
+// 结果作为强ETag，0留作"未知"(旧数据没有哈希)
+namespace storage
+{
+    class ContentHash
+    {
+    public:
+        ContentHash() {
+            acc_[0] = kP1 + kP2;
+            acc_[1] = kP2;
+            acc_[2] = 0;
+            acc_[3] = 0 - kP1;
+        }
+
+        void Update(const void *data, size_t len) {
+            const unsigned char *p = static_cast<const unsigned char *>(data);
+            total_ += len;
+            // 先补齐上次剩下的不足32字节的部分
+            if (buffered_ > 0)
+            {
+                size_t take = std::min(len, sizeof(buf_) - buffered_);
+                memcpy(buf_ + buffered_, p, take);
+                buffered_ += take;
+                p += take;
+                len -= take;
+                if (buffered_ < sizeof(buf_))
+                    return;
+                Stripe(buf_);
+                buffered_ = 0;
+            }
+            for (; len >= sizeof(buf_); p += sizeof(buf_), len -= sizeof(buf_))
+                Stripe(p);
+            memcpy(buf_, p, len);
+            buffered_ = len;
+        }
+
+        uint64_t Final() const {
+            uint64_t h;
+            if (total_ >= sizeof(buf_))
+            {
+                h = Rotl(acc_[0], 1) + Rotl(acc_[1], 7) + Rotl(acc_[2], 12) + Rotl(acc_[3], 18);
+                for (uint64_t v : acc_)
+                    h = (h ^ Round(0, v)) * kP1 + kP4;
+            }
+            else
+                h = kP5;
+            h += total_;
+            const unsigned char *p = buf_;
+            size_t len = buffered_;
+            for (; len >= 8; p += 8, len -= 8)
+                h = Rotl(h ^ Round(0, Read64(p)), 27) * kP1 + kP4;
+            if (len >= 4)
+            {
+                h = Rotl(h ^ Read32(p) * kP1, 23) * kP2 + kP3;
+                p += 4;
+                len -= 4;
+            }
+            for (; len > 0; ++p, --len)
+                h = Rotl(h ^ *p * kP5, 11) * kP1;
+            h ^= h >> 33;
+            h *= kP2;
+            h ^= h >> 29;
+            h *= kP3;
+            h ^= h >> 32;
+            return h != 0 ? h : 1;
+        }
+
+        static uint64_t Of(const void *data, size_t len) {
+            ContentHash h;
+            h.Update(data, len);
+            return h.Final();
+        }
+
+        static std::string Hex(uint64_t h) {
+            char buf[17];
+            snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+            return buf;
+        }
+        // 解析失败返回0
+        static uint64_t FromHex(const std::string &s) {
+            if (s.size() != 16 || s.find_first_not_of("0123456789abcdef") != std::string::npos)
+                return 0;
+            return strtoull(s.c_str(), nullptr, 16);
+        }
+
+    private:
+        static constexpr uint64_t kP1 = 11400714785074694791ULL;
+        static constexpr uint64_t kP2 = 14029467366897019727ULL;
+        static constexpr uint64_t kP3 = 1609587929392839161ULL;
+        static constexpr uint64_t kP4 = 9650029242287828579ULL;
+        static constexpr uint64_t kP5 = 2870177450012600261ULL;
+
+        static uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+        static uint64_t Round(uint64_t acc, uint64_t input) { return Rotl(acc + input * kP2, 31) * kP1; }
+        // 按小端读取
+        static uint64_t Read64(const unsigned char *p) {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        static uint64_t Read32(const unsigned char *p) {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        void Stripe(const unsigned char *p) {
+            for (int i = 0; i < 4; ++i)
+                acc_[i] = Round(acc_[i], Read64(p + i * 8));
+        }
+
+        uint64_t acc_[4];
+        unsigned char buf_[32];
+        size_t buffered_ = 0;
+        uint64_t total_ = 0;
+    };
+}
@@ -1,94 +1,185 @@
 #pragma once
 #include "Config.hpp"
-#include <unordered_map>
+#include "Journal.hpp"
+#include "ListIndex.hpp"
+#include "BlobStore.hpp"
+#include "CompactTable.hpp"
+#include "Snapshot.hpp"
+#include "StorageInfo.hpp"
+#include <atomic>
+#include <chrono>
 #include <pthread.h>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+extern ThreadPool *tp;
 namespace storage
 {
-    // 用作初始化存储文件的属性信息
-    typedef struct StorageInfo{                   
-        time_t mtime_;
-        time_t atime_;
-        size_t fsize_;
-        std::string storage_path_; // 文件存储路径
-        std::string url_;          // 请求URL中的资源路径
-
-        bool NewStorageInfo(const std::string &storage_path) {
-            // 初始化备份文件的信息
-            mylog::GetLogger("asynclogger")->Info("NewStorageInfo start");
-            FileUtil f(storage_path);
-            if (!f.Exists())
-            {
-                mylog::GetLogger("asynclogger")->Info("file not exists");
-                return false;
-            }
-            mtime_ = f.LastAccessTime();
-            atime_ = f.LastModifyTime();
-            fsize_ = f.FileSize();
-            storage_path_ = storage_path;
-            // URL实际就是用户下载文件请求的路径
-            // 下载路径前缀+文件名
-            storage::Config *config = storage::Config::GetInstance();
-            url_ = config->GetDownloadPrefix() + f.FileName();
-            mylog::GetLogger("asynclogger")->Info("download_url:%s,mtime_:%s,atime_:%s,fsize_:%d", url_.c_str(),ctime(&mtime_),ctime(&atime_),fsize_);
-            mylog::GetLogger("asynclogger")->Info("NewStorageInfo end");
-            return true;
+    // pthread读写锁的RAII封装：离开作用域时解锁，持锁期间抛出异常也不会把分片锁死
+    class RWLockGuard
+    {
+    public:
+        RWLockGuard(pthread_rwlock_t *lock, bool write) : lock_(lock) {
+            if (write)
+                pthread_rwlock_wrlock(lock_);
+            else
+                pthread_rwlock_rdlock(lock_);
         }
-    } StorageInfo; // namespace StorageInfo
+        ~RWLockGuard() { Unlock(); }
+        RWLockGuard(const RWLockGuard &) = delete;
+        RWLockGuard &operator=(const RWLockGuard &) = delete;
 
+        // 提前解锁
+        void Unlock() {
+            if (lock_ != nullptr)
+                pthread_rwlock_unlock(lock_);
+            lock_ = nullptr;
+        }
+
+    private:
+        pthread_rwlock_t *lock_;
+    };
+
+    // 持久化：storage_file_是某一时刻的整表快照(见Snapshot)，之后的每次修改追加到日志storage_file_.journal中。
+    // 日志超过journal_max_bytes或每隔snapshot_interval秒，在后台把整表写成新快照并丢弃旧日志。
+    // 启动时先读快照，再按顺序重放上次未完成压缩留下的.journal.old和.journal
+    //
+    // 内存中的表按文件名哈希分成kShards个分片(见CompactTable)，每个分片一把读写锁，
+    // 不同文件的读写互不阻塞，GetAll逐个分片拷贝，不会长时间挡住上传。
+    // 文件列表的有序索引也在各分片的表里，List逐个分片取一段再归并(见ListIndex)。
+    // URL和存储路径的文件名相同，按哪一个查都落在同一个分片
     class DataManager
     {
     private:
+        static constexpr size_t kShards = 64;
+        struct Shard
+        {
+            pthread_rwlock_t rwlock;
+            CompactTable table;
+        };
+
         std::string storage_file_;
-        pthread_rwlock_t rwlock_;
-        std::unordered_map<std::string, StorageInfo> table_;
+        std::string journal_file_;
+        std::mutex persist_mutex_; // 串行化快照的写入
+        Shard shards_[kShards];
         bool need_persist_;
+        std::unique_ptr<Journal> journal_;
+        uint64_t journal_max_bytes_;
+        std::atomic<bool> compacting_{false};
+        std::atomic<bool> mixed_names_{false}; // 出现过URL和路径文件名不同的条目，按路径查要找遍所有分片
+        std::atomic<uint64_t> version_{0};     // 每次增删后加一，在修改之后才加，用作渲染结果的缓存键
+        ThreadPool::TimerId snapshot_timer_ = 0;
 
     public:
         DataManager() {
             mylog::GetLogger("asynclogger")->Info("DataManager construct start");
             storage_file_ = storage::Config::GetInstance()->GetStorageInfoFile();
-            pthread_rwlock_init(&rwlock_, NULL);
+            journal_file_ = storage_file_ + ".journal";
+            journal_max_bytes_ = storage::Config::GetInstance()->GetJournalMaxBytes();
+            for (auto &sh : shards_)
+                pthread_rwlock_init(&sh.rwlock, NULL);
             need_persist_ = false;
-            InitLoad();
+            // 加载失败时表中只有部分数据，之后的压缩会用它覆盖快照并删掉日志，不能带着它启动
+            if (!InitLoad())
+            {
+                mylog::GetLogger("asynclogger")->Error("load %s failed, refuse to start", storage_file_.c_str());
+                throw std::runtime_error("load metadata " + storage_file_ + " failed");
+            }
+            journal_.reset(new Journal(journal_file_));
+            journal_->Open();
+            // 上次压缩中途退出，先把已加载的整表写成快照
+            if (FileUtil(journal_file_ + ".old").Exists())
+                Compact();
             need_persist_ = true;
+            int interval = storage::Config::GetInstance()->GetSnapshotInterval();
+            if (interval > 0 && tp != nullptr)
+                snapshot_timer_ = tp->schedule_every(std::chrono::seconds(interval), [this]
+                                                     { ScheduleCompact(1); }, ThreadPool::Priority::LOW);
             mylog::GetLogger("asynclogger")->Info("DataManager construct end");
         }
         ~DataManager() {
-            pthread_rwlock_destroy(&rwlock_);
+            if (snapshot_timer_ != 0 && tp != nullptr)
+                tp->cancel(snapshot_timer_);
+            for (auto &sh : shards_)
+                pthread_rwlock_destroy(&sh.rwlock);
         }
 
         bool InitLoad() {
             mylog::GetLogger("asynclogger")->Info("init datamanager");
             storage::FileUtil f(storage_file_);
-            if (!f.Exists()){
+            if (f.Exists())
+            {
+                std::vector<StorageInfo> arr;
+                if (Snapshot::IsBinary(storage_file_))
+                {
+                    if (!Snapshot::Load(storage_file_, &arr))
+                    {
+                        mylog::GetLogger("asynclogger")->Error("load snapshot %s failed", storage_file_.c_str());
+                        return false;
+                    }
+                }
+                else
+                {
+                    // 旧版本或snapshot_format为json时写的JSON快照
+                    std::string body;
+                    Json::Value root;
+                    if (!f.GetContent(&body) || !storage::JsonUtil::UnSerialize(body, &root))
+                    {
+                        mylog::GetLogger("asynclogger")->Error("load snapshot %s failed", storage_file_.c_str());
+                        return false;
+                    }
+                    arr.reserve(root.size());
+                    for (Json::ArrayIndex i = 0; i < root.size(); i++)
+                        arr.emplace_back(FromJson(root[i]));
+                }
+                BuildShards(arr);
+                std::vector<StorageInfo>().swap(arr);
+            }
+            else
+            {
                 mylog::GetLogger("asynclogger")->Info("there is no storage file info need to load");
-                return true;
             }
-
-            std::string body;
-            if (!f.GetContent(&body))
-                return false;
-
-            // 反序列化
-            Json::Value root;
-            storage::JsonUtil::UnSerialize(body, &root);
-            // 3，将反序列化得到的Json::Value中的数据添加到table中
-            for (int i = 0; i < root.size(); i++)
+            // 快照之后的修改
+            size_t replayed = 0;
+            auto apply = [this, &replayed](const std::string &line)
+            {
+                Json::Value rec;
+                if (!JsonUtil::UnSerialize(line, &rec))
+                    return;
+                if (rec["op"].asString() == "put")
+                {
+                    StorageInfo info = FromJson(rec);
+                    if (CheckLength(info))
+                        PutLocked(info);
+                }
+                else if (rec["op"].asString() == "del")
+                {
+                    std::string url = rec["url_"].asString();
+                    if (ShardOf(url).table.Erase(url, nullptr))
+                        ++version_;
+                }
+                ++replayed;
+            };
+            Journal::Replay(journal_file_ + ".old", apply);
+            Journal::Replay(journal_file_, apply);
+            ForShards([this](size_t i)
+                      { shards_[i].table.BuildOrders(); });
+            mylog::GetLogger("asynclogger")->Info("loaded %zu files, replayed %zu journal records", Size(), replayed);
+            auto used = [this](const std::string &path)
             {
                 StorageInfo info;
-                info.fsize_ = root[i]["fsize_"].asInt();
-                info.atime_ = root[i]["atime_"].asInt();
-                info.mtime_ = root[i]["mtime_"].asInt();
-                info.storage_path_ = root[i]["storage_path_"].asString();
-                info.url_ = root[i]["url_"].asString();
-                Insert(info);
-            }
+                return GetOneByStoragePath(path, &info);
+            };
+            BlobStore::Sweep(storage::Config::GetInstance()->GetLowStorageDir(), used);
+            BlobStore::Sweep(storage::Config::GetInstance()->GetDeepStorageDir(), used);
             return true;
         }
 
+        // 把表中的数据写成新快照：先写临时文件并fsync，再rename覆盖
         bool Storage() {
-// 把table_中的数据转成json格式存入文件
             mylog::GetLogger("asynclogger")->Info("message storage start");
+            std::unique_lock<std::mutex> lock(persist_mutex_);
             std::vector<StorageInfo> arr;
             if (!GetAll(&arr))
             {
@@ -96,41 +187,60 @@ namespace storage
                 return false;
             }
 
-            Json::Value root; // root中存着json::value对象
-            for (auto e : arr)
+            // 写入临时文件
+            std::string tmp = storage_file_ + ".tmp";
+            int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            bool ok = fd != -1;
+            if (ok && storage::Config::GetInstance()->GetSnapshotFormat() == "json")
+                ok = WriteJson(fd, arr);
+            else if (ok)
+                ok = Snapshot::Write(fd, arr);
+            ok = ok && fsync(fd) == 0;
+            if (fd != -1)
+                close(fd);
+            if (!ok || rename(tmp.c_str(), storage_file_.c_str()) != 0)
             {
-                Json::Value item;
-                item["mtime_"] = (Json::Int64)e.mtime_;
-                item["atime_"] = (Json::Int64)e.atime_;
-                item["fsize_"] = (Json::Int64)e.fsize_;
-                item["url_"] = e.url_.c_str();
-                item["storage_path_"] = e.storage_path_.c_str();
-                root.append(item); // 作为数组
+                mylog::GetLogger("asynclogger")->Error("write snapshot %s err: %s", storage_file_.c_str(), strerror(errno));
+                unlink(tmp.c_str());
+                return false;
             }
+            Journal::SyncDir(storage_file_);
+            mylog::GetLogger("asynclogger")->Info("message storage end, %zu files", arr.size());
+            return true;
+        }
 
-            // 序列化
-            std::string body;
-            mylog::GetLogger("asynclogger")->Info("new message for StorageInfo:%s", body.c_str());
-            JsonUtil::Serialize(root, &body);
-
-            // 写入文件
-            FileUtil f(storage_file_);
-            
-            if (f.SetContent(body.c_str(),body.size()) == false)
-                mylog::GetLogger("asynclogger")->Error("SetContent for StorageInfo Error");
-
-            mylog::GetLogger("asynclogger")->Info("message storage end");
+        // 压缩：日志改名为.old后再拍快照，快照一定包含.old中的全部修改，写好后.old即可删除。
+        // 拍快照期间追加到新日志的修改可能也在快照里，重放时覆盖同样的值，不影响结果
+        bool Compact() {
+            std::string old = journal_file_ + ".old";
+            // .old还在说明上次压缩没完成，它的修改已经在表中，不能再轮转覆盖它
+            if (!FileUtil(old).Exists() && !journal_->Rotate(old))
+                return false;
+            if (!Storage())
+                return false;
+            unlink(old.c_str());
+            Journal::SyncDir(old);
             return true;
         }
 
         bool Insert(const StorageInfo &info) {
             mylog::GetLogger("asynclogger")->Info("data_message Insert start");
-            pthread_rwlock_wrlock(&rwlock_); // 加写锁
-            table_[info.url_] = info;
-            pthread_rwlock_unlock(&rwlock_);
-            if (need_persist_ == true && Storage() == false)
+            if (!CheckLength(info))
+                return false;
+            std::string record = need_persist_ ? Record("put", info) : "";
+            Shard &sh = ShardOf(info.url_);
+            RWLockGuard lock(&sh.rwlock, true); // 加写锁
+            StorageInfo old;
+            bool replaced = PutLocked(info, &old);
+            // 在分片锁内排进日志，同一文件的修改在日志中的顺序与表中一致
+            uint64_t seq = need_persist_ ? journal_->Enqueue(record) : 0;
+            lock.Unlock();
+            if (replaced)
+                ReleaseReplaced(old, info);
+            if (need_persist_ == true && Persist(seq) == false)
             {
                 mylog::GetLogger("asynclogger")->Error("data_message Insert:Storage Error");
+                Rollback(info);
                 return false;
             }
             mylog::GetLogger("asynclogger")->Info("data_message Insert end");
@@ -139,10 +249,18 @@ namespace storage
 
         bool Update(const StorageInfo &info) {
             mylog::GetLogger("asynclogger")->Info("data_message Update start");
-            pthread_rwlock_wrlock(&rwlock_);
-            table_[info.url_] = info;
-            pthread_rwlock_unlock(&rwlock_);
-            if (Storage() == false)
+            if (!CheckLength(info))
+                return false;
+            std::string record = Record("put", info);
+            Shard &sh = ShardOf(info.url_);
+            RWLockGuard lock(&sh.rwlock, true);
+            StorageInfo old;
+            bool replaced = PutLocked(info, &old);
+            uint64_t seq = journal_->Enqueue(record);
+            lock.Unlock();
+            if (replaced)
+                ReleaseReplaced(old, info);
+            if (Persist(seq) == false)
             {
                 mylog::GetLogger("asynclogger")->Error("data_message Update:Storage Error");
                 return false;
@@ -151,60 +269,88 @@ namespace storage
             return true;
         }
         bool GetOneByURL(const std::string &key, StorageInfo *info) {
-            pthread_rwlock_rdlock(&rwlock_);
-            // URL是key，所以直接find()找
-            if (table_.find(key) == table_.end())
-            {
-                pthread_rwlock_unlock(&rwlock_);
-                return false;
-            }
-            *info = table_[key]; // 获取url对应的文件存储信息
-            pthread_rwlock_unlock(&rwlock_);
-            return true;
+            Shard &sh = ShardOf(key);
+            RWLockGuard lock(&sh.rwlock, false);
+            // URL是key，所以直接找
+            return sh.table.Get(key, info);
         }
         bool GetOneByStoragePath(const std::string &storage_path, StorageInfo *info) {
-            pthread_rwlock_rdlock(&rwlock_);
-            // 遍历 通过realpath字段找到对应存储信息
-            for (auto e : table_)
+            bool found;
             {
-                if (e.second.storage_path_ == storage_path)
-                {
-                    *info = e.second;
-                    pthread_rwlock_unlock(&rwlock_);
+                Shard &sh = ShardOf(storage_path);
+                RWLockGuard lock(&sh.rwlock, false);
+                found = sh.table.GetByPath(storage_path, info);
+            }
+            if (found || !mixed_names_)
+                return found;
+            for (auto &other : shards_)
+            {
+                RWLockGuard lock(&other.rwlock, false);
+                if (other.table.GetByPath(storage_path, info))
                     return true;
-                }
             }
-            pthread_rwlock_unlock(&rwlock_);
             return false;
         }
+        // 逐个分片拷贝，同一时间只占用一个分片的读锁
         bool GetAll(std::vector<StorageInfo> *arry) {
-            pthread_rwlock_rdlock(&rwlock_);
-            for (auto e : table_)
-                arry->emplace_back(e.second);
-            pthread_rwlock_unlock(&rwlock_);
+            arry->reserve(arry->size() + Size());
+            for (auto &sh : shards_)
+            {
+                RWLockGuard lock(&sh.rwlock, false);
+                sh.table.ForEach([arry](const StorageInfo &e)
+                                 { arry->emplace_back(e); });
+            }
             return true;
         }
+        // 分页列出文件：逐个分片在读锁内取出游标之后的一段，再归并成一页，同一时间只占用一个分片的读锁。
+        // 游标格式不对返回false
+        bool List(const ListIndex::Query &q, std::vector<StorageInfo> *arry, std::string *next) {
+            CompactTable::Key after;
+            if (!q.cursor.empty() && !ListIndex::ParseCursor(q, &after))
+                return false;
+            std::vector<ListIndex::Part> parts(kShards);
+            for (size_t i = 0; i < kShards; ++i)
+            {
+                Shard &sh = shards_[i];
+                RWLockGuard lock(&sh.rwlock, false);
+                parts[i].stopped = sh.table.Scan(q.sort, q.desc, q.cursor.empty() ? nullptr : &after, q.prefix, q.limit,
+                                                 ListIndex::kScanBudget, &parts[i].items, &parts[i].stop);
+            }
+            ListIndex::Merge(q, parts, arry, next);
+            return true;
+        }
+        // 数据版本，先取版本再读数据，版本不变说明读到的仍是最新的
+        uint64_t Version() { return version_.load(); }
+        size_t Size() {
+            size_t n = 0;
+            for (auto &sh : shards_)
+            {
+                RWLockGuard lock(&sh.rwlock, false);
+                n += sh.table.Size();
+            }
+            return n;
+        }
         
         bool DeleteByURL(const std::string &url) {
             mylog::GetLogger("asynclogger")->Info("data_message Delete start, url: %s", url.c_str());
-            pthread_rwlock_wrlock(&rwlock_); // 加写锁
+            Shard &sh = ShardOf(url);
+            RWLockGuard lock(&sh.rwlock, true); // 加写锁
             
-            // 检查URL是否存在
-            auto it = table_.find(url);
-            if (it == table_.end())
+            // 检查URL是否存在并删除
+            StorageInfo info;
+            if (!sh.table.Erase(url, &info))
             {
-                pthread_rwlock_unlock(&rwlock_);
+                lock.Unlock();
                 mylog::GetLogger("asynclogger")->Warn("URL not found: %s", url.c_str());
                 return false;
             }
-            
-            // 删除文件
-            std::string storage_path = it->second.storage_path_;
-            table_.erase(it);
-            pthread_rwlock_unlock(&rwlock_);
+            ++version_;
+            uint64_t seq = need_persist_ ? journal_->Enqueue(Record("del", info)) : 0;
+            lock.Unlock();
+            std::string storage_path = info.storage_path_;
             
             // 持久化存储
-            if (need_persist_ == true && Storage() == false)
+            if (need_persist_ == true && Persist(seq) == false)
             {
                 mylog::GetLogger("asynclogger")->Error("data_message Delete:Storage Error");
                 return false;
@@ -215,9 +361,176 @@ namespace storage
             {
                 mylog::GetLogger("asynclogger")->Warn("Failed to delete file: %s", storage_path.c_str());
             }
+            BlobStore::Release(info);
             
             mylog::GetLogger("asynclogger")->Info("data_message Delete end, file: %s", storage_path.c_str());
             return true;
         }
+
+    private:
+        // 按最后一个'/'之后的文件名分片
+        static size_t ShardIndex(const std::string &key) {
+            size_t pos = key.find_last_of('/');
+            std::string_view name(key);
+            if (pos != std::string::npos)
+                name.remove_prefix(pos + 1);
+            return std::hash<std::string_view>()(name) % kShards;
+        }
+        Shard &ShardOf(const std::string &key) { return shards_[ShardIndex(key)]; }
+
+        // 启动时各分片互不相干，分给按CPU核数的几个线程同时处理，fn(i)处理第i个分片
+        static void ForShards(const std::function<void(size_t)> &fn) {
+            size_t threads = std::min<size_t>(kShards, std::max(1u, std::thread::hardware_concurrency()));
+            std::atomic<size_t> next(0);
+            auto run = [&]()
+            {
+                for (size_t i = next++; i < kShards; i = next++)
+                    fn(i);
+            };
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < threads; ++t)
+                workers.emplace_back(run);
+            run();
+            for (auto &t : workers)
+                t.join();
+        }
+
+        // 快照中的条目先按分片分组，再由ForShards各自建表；还没有对外服务，不用加锁
+        void BuildShards(const std::vector<StorageInfo> &arr) {
+            std::vector<std::vector<uint32_t>> groups(kShards);
+            for (size_t i = 0; i < arr.size(); ++i)
+                groups[ShardIndex(arr[i].url_)].push_back(i);
+            std::atomic<size_t> loaded(0);
+            ForShards([&](size_t i)
+                      {
+                          CompactTable &table = shards_[i].table;
+                          table.Reserve(groups[i].size()); // 预先分好桶，建表时不再rehash
+                          bool mixed = false;
+                          for (uint32_t idx : groups[i])
+                          {
+                              const StorageInfo &e = arr[idx];
+                              if (!CheckLength(e))
+                                  continue;
+                              mixed = mixed || ShardIndex(e.storage_path_) != i;
+                              table.Put(e);
+                          }
+                          loaded += table.Size();
+                          if (mixed)
+                              mixed_names_ = true;
+                          std::vector<uint32_t>().swap(groups[i]); });
+            version_ += loaded;
+        }
+
+        // 表中放不下的条目在加锁之前拒绝，见CompactTable::Fits
+        static bool CheckLength(const StorageInfo &info) {
+            if (CompactTable::Fits(info))
+                return true;
+            mylog::GetLogger("asynclogger")->Warn("name too long, %zu bytes: %s", info.url_.size(),
+                                                  info.url_.substr(0, 64).c_str());
+            return false;
+        }
+
+        // 日志没写成功时撤掉Insert放进表里的条目，调用方随后删除文件；期间又被覆盖或删除的不动
+        void Rollback(const StorageInfo &info) {
+            Shard &sh = ShardOf(info.url_);
+            RWLockGuard lock(&sh.rwlock, true);
+            StorageInfo cur;
+            if (!sh.table.Get(info.url_, &cur) || cur.storage_path_ != info.storage_path_ ||
+                cur.hash_ != info.hash_ || cur.mtime_ != info.mtime_)
+                return;
+            sh.table.Erase(info.url_, &cur);
+            ++version_;
+        }
+
+        // 调用方持该URL所在分片的写锁，覆盖已有条目时返回true并由old带回旧信息
+        bool PutLocked(const StorageInfo &info, StorageInfo *old = nullptr) {
+            if (&ShardOf(info.url_) != &ShardOf(info.storage_path_))
+                mixed_names_ = true;
+            bool replaced = ShardOf(info.url_).table.Put(info, old);
+            ++version_;
+            return replaced;
+        }
+
+        // 同名文件被覆盖上传，旧内容的blob可能已经没有文件链接它
+        static void ReleaseReplaced(const StorageInfo &old, const StorageInfo &info) {
+            if (old.hash_ != info.hash_ || old.storage_path_ != info.storage_path_)
+                BlobStore::Release(old);
+        }
+
+        // JSON数组格式的快照，只用于导出查看
+        static bool WriteJson(int fd, const std::vector<StorageInfo> &arr) {
+            Json::Value root; // root中存着json::value对象
+            for (auto &e : arr)
+                root.append(ToJson(e)); // 作为数组
+            std::string body;
+            JsonUtil::Serialize(root, &body);
+            size_t off = 0;
+            while (off < body.size())
+            {
+                ssize_t n = write(fd, body.data() + off, body.size() - off);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                off += n;
+            }
+            return true;
+        }
+
+        static Json::Value ToJson(const StorageInfo &e) {
+            Json::Value item;
+            item["mtime_"] = (Json::Int64)e.mtime_;
+            item["atime_"] = (Json::Int64)e.atime_;
+            item["fsize_"] = (Json::Int64)e.fsize_;
+            if (e.hash_ != 0)
+                item["hash_"] = ContentHash::Hex(e.hash_);
+            item["url_"] = e.url_.c_str();
+            item["storage_path_"] = e.storage_path_.c_str();
+            return item;
+        }
+        static StorageInfo FromJson(const Json::Value &v) {
+            StorageInfo info;
+            info.fsize_ = v["fsize_"].asInt64();
+            info.atime_ = v["atime_"].asInt64();
+            info.mtime_ = v["mtime_"].asInt64();
+            info.hash_ = ContentHash::FromHex(v["hash_"].asString());
+            info.storage_path_ = v["storage_path_"].asString();
+            info.url_ = v["url_"].asString();
+            return info;
+        }
+
+        // 一条修改记录
+        static std::string Record(const char *op, const StorageInfo &info) {
+            Json::Value rec = ToJson(info);
+            rec["op"] = op;
+            Json::StreamWriterBuilder swb;
+            swb["emitUTF8"] = true;
+            swb["indentation"] = "";
+            return Json::writeString(swb, rec);
+        }
+
+        // 等待已排进日志的第seq条记录落盘，日志过大时安排后台压缩
+        bool Persist(uint64_t seq) {
+            bool ok = journal_->Wait(seq);
+            ScheduleCompact(journal_max_bytes_);
+            return ok;
+        }
+
+        // 日志不小于min_bytes时在线程池LOW通道中压缩，同一时间只有一个压缩任务
+        void ScheduleCompact(uint64_t min_bytes) {
+            if (tp == nullptr || journal_->Size() < min_bytes || compacting_.exchange(true))
+                return;
+            try
+            {
+                tp->enqueue_to(ThreadPool::Priority::LOW, [this]
+                               {
+                    Compact();
+                    compacting_ = false; });
+            }
+            catch (const std::runtime_error &e)
+            {
+                compacting_ = false;
+            }
+        }
     }; // namespace DataManager
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#pragma once
+#include "DataManager.hpp"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 深度存储文件的解压缓存：解压结果放在独立目录中按LRU淘汰，总大小不超过capacity。
+// 同一个文件的并发请求只解压一次，其余请求等待第一次解压完成后共用结果
+namespace storage
+{
+    class DecompressCache
+    {
+    public:
+        // 指向解压后文件路径，最后一个Handle释放之前该文件不会被淘汰
+        using Handle = std::shared_ptr<const std::string>;
+
+        DecompressCache(const std::string &dir, uint64_t capacity)
+            : dir_(dir), capacity_(capacity) {
+            FileUtil fu(dir_);
+            fu.CreateDirectory();
+            // 上次运行留下的缓存文件没有索引，直接清掉。目录可能配置成了和别的文件共用，只删按本缓存命名的文件
+            std::vector<std::string> files;
+            fu.ScanDirectory(&files);
+            size_t removed = 0;
+            for (auto &f : files)
+            {
+                std::string name = FileUtil(f).FileName();
+                if (IsCacheName(name) && unlink((dir_ + name).c_str()) == 0)
+                    ++removed;
+            }
+            mylog::GetLogger("asynclogger")->Info("decompress cache %s: %zu stale files removed", dir_.c_str(), removed);
+        }
+
+        // 在工作线程中调用，可能阻塞在解压或等待其他线程解压上。失败返回空Handle
+        Handle Acquire(const StorageInfo &info) {
+            // 文件被覆盖上传后内容哈希会变(同一秒内大小相同也能区分)，旧的缓存自然失效并随LRU淘汰；
+            // 大小和时间留给没有哈希的旧条目
+            std::string key = info.storage_path_ + "#" + std::to_string(info.fsize_) + "#" + std::to_string(info.mtime_) +
+                              "#" + ContentHash::Hex(info.hash_);
+            std::unique_lock<std::mutex> lock(mtx_);
+            for (;;)
+            {
+                auto it = entries_.find(key);
+                if (it == entries_.end())
+                    break;
+                Entry &e = it->second;
+                if (e.state == Entry::READY)
+                {
+                    ++e.refs;
+                    lru_.splice(lru_.begin(), lru_, e.lru);
+                    return MakeHandle(key, e.path);
+                }
+                // 其他线程正在解压，等它完成；失败时条目被删掉，本线程重新尝试
+                cond_.wait(lock);
+            }
+
+            Entry &e = entries_[key];
+            e.path = dir_ + kNamePrefix + ContentHash::Hex(std::hash<std::string>()(key)) + "." +
+                     FileUtil(info.storage_path_).FileName();
+            e.refs = 1;
+            lock.unlock();
+
+            // 先解压到临时名再rename，其他线程只会看到完整的文件
+            std::string part = e.path + ".part";
+            mylog::GetLogger("asynclogger")->Info("uncompressing:%s", info.storage_path_.c_str());
+            bool ok = FileUtil(info.storage_path_).UnCompress(part) && rename(part.c_str(), e.path.c_str()) == 0;
+            int64_t size = ok ? FileUtil(e.path).FileSize() : -1;
+
+            lock.lock();
+            if (!ok || size < 0)
+            {
+                mylog::GetLogger("asynclogger")->Warn("uncompress %s failed", info.storage_path_.c_str());
+                unlink(part.c_str());
+                entries_.erase(key);
+                cond_.notify_all();
+                return Handle();
+            }
+            e.state = Entry::READY;
+            e.size = size;
+            used_ += size;
+            e.lru = lru_.insert(lru_.begin(), key);
+            EvictLocked();
+            cond_.notify_all();
+            return MakeHandle(key, e.path);
+        }
+
+        uint64_t Used() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return used_;
+        }
+
+    private:
+        // 缓存文件名：dcache.<16位十六进制的key哈希>.<原文件名>，解压中的再加.part
+        static constexpr const char *kNamePrefix = "dcache.";
+
+        static bool IsCacheName(const std::string &name) {
+            size_t n = strlen(kNamePrefix);
+            return name.size() > n + 17 && name.compare(0, n, kNamePrefix) == 0 &&
+                   name.find_first_not_of("0123456789abcdef", n) == n + 16 && name[n + 16] == '.';
+        }
+
+        struct Entry
+        {
+            enum State { LOADING, READY };
+            State state = LOADING;
+            std::string path;
+            uint64_t size = 0;
+            int refs = 0;                          // 正在使用该文件的请求数
+            std::list<std::string>::iterator lru;  // READY之后才有效
+        };
+
+        Handle MakeHandle(const std::string &key, const std::string &path) {
+            return Handle(new std::string(path), [this, key](const std::string *p)
+                          {
+                delete p;
+                Release(key); });
+        }
+
+        void Release(const std::string &key) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            auto it = entries_.find(key);
+            if (it != entries_.end() && --it->second.refs == 0)
+                EvictLocked();
+        }
+
+        // 从最久未用的一端开始删除没有被引用的文件，直到不超过容量
+        void EvictLocked() {
+            auto it = lru_.end();
+            while (used_ > capacity_ && it != lru_.begin())
+            {
+                --it;
+                auto e = entries_.find(*it);
+                if (e->second.refs > 0)
+                    continue;
+                unlink(e->second.path.c_str());
+                used_ -= e->second.size;
+                entries_.erase(e);
+                it = lru_.erase(it);
+            }
+        }
+
+    private:
+        std::string dir_;
+        uint64_t capacity_;
+        uint64_t used_ = 0;
+        std::mutex mtx_;
+        std::condition_variable cond_;
+        std::unordered_map<std::string, Entry> entries_; // 节点式容器，解锁期间Entry的引用保持有效
+        std::list<std::string> lru_;                     // 头部是最近使用的key
+    };
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include "Util.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 只追加的元数据日志：每条记录一行，Append返回时记录已经落盘。
+// 并发的Append合并成一次write+fdatasync(组提交)，单次修改的代价与已有记录数无关
+namespace storage
+{
+    class Journal
+    {
+    public:
+        explicit Journal(const std::string &path) : path_(path) {}
+        ~Journal() {
+            if (fd_ != -1)
+                close(fd_);
+        }
+
+        bool Open() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return OpenLocked();
+        }
+
+        // 追加一条不含换行的记录并等待落盘
+        bool Append(const std::string &record) {
+            return Wait(Enqueue(record));
+        }
+
+        // 追加一条不含换行的记录，返回它的序号，不等待落盘。记录在日志中的顺序就是调用的顺序，
+        // 调用方在修改内存数据的同一把锁内调用，日志顺序才与内存中的修改顺序一致
+        uint64_t Enqueue(const std::string &record) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            pending_ += record;
+            pending_ += '\n';
+            return ++appended_;
+        }
+
+        // 等待序号为seq的记录落盘，失败返回false
+        bool Wait(uint64_t seq) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            // 没有线程在刷盘时由当前线程把积累的记录一起刷下去，否则等别人刷完
+            while (synced_ < seq)
+            {
+                if (flushing_)
+                {
+                    cond_.wait(lock);
+                    continue;
+                }
+                FlushLocked(lock);
+            }
+            for (auto &r : failed_)
+                if (seq >= r.first && seq <= r.second)
+                    return false;
+            return true;
+        }
+
+        // 把当前日志改名为old_path并换一个新日志，之后的记录都写入新文件
+        bool Rotate(const std::string &old_path) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            while (flushing_)
+                cond_.wait(lock);
+            if (!pending_.empty())
+                FlushLocked(lock);
+            if (fd_ != -1)
+                close(fd_);
+            fd_ = -1;
+            if (rename(path_.c_str(), old_path.c_str()) != 0)
+            {
+                mylog::GetLogger("asynclogger")->Error("rotate journal %s err: %s", path_.c_str(), strerror(errno));
+                OpenLocked();
+                return false;
+            }
+            return OpenLocked();
+        }
+
+        uint64_t Size() {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return size_;
+        }
+
+        // 依次回调path中每条完整的记录，最后一行没有换行说明写到一半时崩溃了，忽略
+        static bool Replay(const std::string &path, const std::function<void(const std::string &)> &fn) {
+            std::ifstream ifs(path.c_str(), std::ios::binary);
+            if (!ifs.is_open())
+                return false;
+            std::string line;
+            while (std::getline(ifs, line))
+            {
+                if (ifs.eof())
+                {
+                    mylog::GetLogger("asynclogger")->Warn("journal %s: drop torn record", path.c_str());
+                    break;
+                }
+                if (!line.empty())
+                    fn(line);
+            }
+            return true;
+        }
+
+        // rename之后需要同步目录，重启后才能看到新的文件名
+        static void SyncDir(const std::string &path) {
+            std::string dir = path.substr(0, path.find_last_of('/') + 1);
+            int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd == -1)
+                return;
+            fsync(fd);
+            close(fd);
+        }
+
+    private:
+        bool OpenLocked() {
+            fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+            if (fd_ == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("open journal %s err: %s", path_.c_str(), strerror(errno));
+                return false;
+            }
+            struct stat st;
+            size_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+            TrimTorn();
+            torn_ = false;
+            SyncDir(path_);
+            return true;
+        }
+
+        // 截掉末尾写了一半的记录，否则新记录会接在它后面一起变成坏行
+        void TrimTorn() {
+            off_t end = size_;
+            char c;
+            while (end > 0 && pread(fd_, &c, 1, end - 1) == 1 && c != '\n')
+                --end;
+            if ((uint64_t)end != size_ && ftruncate(fd_, end) == 0)
+            {
+                mylog::GetLogger("asynclogger")->Warn("journal %s: truncate torn tail %lu -> %ld", path_.c_str(), size_, (long)end);
+                size_ = end;
+            }
+        }
+
+        // 调用方持锁且没有其他线程在刷盘，期间会临时解锁让其他线程继续追加
+        void FlushLocked(std::unique_lock<std::mutex> &lock) {
+            flushing_ = true;
+            std::string batch;
+            batch.swap(pending_);
+            uint64_t from = synced_ + 1, to = appended_;
+            int fd = fd_;
+            uint64_t good = size_; // 之前的记录都完整地结束在这里
+            bool torn = torn_;
+            lock.unlock();
+            // 上次写失败后没能截掉的半条记录，先截掉，截不掉就不能再往后接
+            bool ok = fd != -1 && (!torn || ftruncate(fd, good) == 0);
+            const char *data = batch.data();
+            size_t len = batch.size();
+            while (ok && len > 0)
+            {
+                ssize_t n = write(fd, data, len);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                ok = n > 0;
+                if (ok)
+                {
+                    data += n;
+                    len -= n;
+                }
+            }
+            ok = ok && fdatasync(fd) == 0;
+            int err = errno;
+            // 部分写入的记录留在文件中间会和下一批记录粘成一个坏行，截回到上一条完整记录的末尾
+            if (!ok && fd != -1)
+                torn = ftruncate(fd, good) != 0;
+            lock.lock();
+            torn_ = torn;
+            if (ok)
+                size_ += batch.size();
+            else
+            {
+                mylog::GetLogger("asynclogger")->Error("journal %s write err: %s", path_.c_str(), strerror(err));
+                failed_.emplace_back(from, to);
+            }
+            synced_ = to;
+            flushing_ = false;
+            cond_.notify_all();
+        }
+
+    private:
+        std::string path_;
+        int fd_ = -1;
+        uint64_t size_ = 0;
+        std::mutex mtx_;
+        std::condition_variable cond_;
+        std::string pending_;   // 还没刷盘的记录
+        uint64_t appended_ = 0; // 已追加的记录序号
+        uint64_t synced_ = 0;   // 已刷盘(或已确定失败)的记录序号
+        bool flushing_ = false;
+        bool torn_ = false;     // 末尾可能有写了一半的记录
+        std::vector<std::pair<uint64_t, uint64_t>> failed_; // 刷盘失败的序号区间，出错很少，不做清理
+    };
+}
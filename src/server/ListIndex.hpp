@@ -0,0 +1,106 @@
+#pragma once
+#include "CompactTable.hpp"
+#include "StorageInfo.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// 文件列表的分页查询。按URL(即文件名)、修改时间、大小的有序索引在每个分片的CompactTable里，
+// 随分片一起在分片写锁内维护；查询时逐个分片在读锁内取出游标之后的一段(见CompactTable::Scan)，
+// 这里把各分片的结果归并成一页，代价只和页大小、分片数有关。
+// 翻页用游标记住上一页最后一个条目，期间有增删也不会重复或漏掉其余条目
+namespace storage
+{
+    class ListIndex
+    {
+    public:
+        using Sort = CompactTable::Order;
+        struct Query
+        {
+            Sort sort = Sort::NAME;
+            bool desc = false;
+            std::string prefix; // URL前缀
+            std::string cursor; // 上一页返回的next，为空从头开始
+            size_t limit = 100;
+        };
+
+        // 一个分片取出的一段
+        struct Part
+        {
+            std::vector<StorageInfo> items;
+            bool stopped = false; // 检查条数用完停在了stop，后面还没检查
+            CompactTable::Key stop;
+        };
+
+        // 按修改时间/大小排序时前缀不连续，每个分片每次最多检查这么多条，持读锁的时间有上限
+        static constexpr size_t kScanBudget = 1024;
+
+        // 游标格式：按名字排序时是URL，否则是"排序值,URL"。格式不对返回false
+        static bool ParseCursor(const Query &q, CompactTable::Key *key) {
+            if (q.sort == Sort::NAME)
+            {
+                key->value = 0;
+                key->url = q.cursor;
+                return true;
+            }
+            size_t comma = q.cursor.find(',');
+            char *end = nullptr;
+            key->value = strtoll(q.cursor.c_str(), &end, 10);
+            if (comma == std::string::npos || end != q.cursor.c_str() + comma)
+                return false;
+            key->url = q.cursor.substr(comma + 1);
+            return true;
+        }
+
+        // 把各分片的结果归并成一页追加到page，还可能有下一页时next为下一页的游标，否则为空
+        static void Merge(const Query &q, std::vector<Part> &parts, std::vector<StorageInfo> *page, std::string *next) {
+            next->clear();
+            // 按查询方向a排在b之前
+            auto before = [&q](int64_t va, const std::string &ua, int64_t vb, const std::string &ub)
+            {
+                if (va != vb)
+                    return q.desc ? va > vb : va < vb;
+                return q.desc ? ua > ub : ua < ub;
+            };
+            // 停下的分片中最靠前的停止位置：那个分片在它之后的条目还没检查，这一页不能越过它
+            const CompactTable::Key *bound = nullptr;
+            bool more = false;
+            std::vector<StorageInfo *> all;
+            for (auto &p : parts)
+            {
+                if (p.stopped && (bound == nullptr || before(p.stop.value, p.stop.url, bound->value, bound->url)))
+                    bound = &p.stop;
+                more = more || p.items.size() >= q.limit;
+                for (auto &e : p.items)
+                    all.push_back(&e);
+            }
+            std::sort(all.begin(), all.end(), [&](const StorageInfo *a, const StorageInfo *b)
+                      { return before(ValueOf(q.sort, *a), a->url_, ValueOf(q.sort, *b), b->url_); });
+
+            size_t taken = 0;
+            for (StorageInfo *e : all)
+            {
+                if (taken >= q.limit)
+                    break;
+                if (bound != nullptr && before(bound->value, bound->url, ValueOf(q.sort, *e), e->url_))
+                    break;
+                page->push_back(std::move(*e));
+                ++taken;
+            }
+            if (taken == q.limit && (more || bound != nullptr || taken < all.size()))
+                *next = Cursor(q.sort, ValueOf(q.sort, page->back()), page->back().url_);
+            else if (taken < q.limit && bound != nullptr)
+                *next = Cursor(q.sort, bound->value, bound->url);
+        }
+
+    private:
+        static int64_t ValueOf(Sort sort, const StorageInfo &e) {
+            return sort == Sort::MTIME ? e.mtime_ : (sort == Sort::SIZE ? (int64_t)e.fsize_ : 0);
+        }
+
+        static std::string Cursor(Sort sort, int64_t value, const std::string &url) {
+            return sort == Sort::NAME ? url : std::to_string(value) + "," + url;
+        }
+    };
+}
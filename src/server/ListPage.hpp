@@ -0,0 +1,97 @@
+#pragma once
+#include "Util.hpp"
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 文件列表页面：index.html只在文件变化时重新读取，并预先按{{NAME}}占位符切成片段，
+// 渲染时直接拼接，不再每次读文件和跑正则。
+// 渲染好的页面按(模板版本, DataManager版本)缓存，文件和模板都没变时直接返回缓存
+namespace storage
+{
+    class ListPage
+    {
+    public:
+        // texts比names多一个：texts[0] names[0] texts[1] ... names[n-1] texts[n]
+        struct Template
+        {
+            uint64_t generation;
+            std::vector<std::string> texts;
+            std::vector<std::string> names;
+        };
+        using TemplatePtr = std::shared_ptr<const Template>;
+        using Page = std::shared_ptr<const std::string>;
+
+        explicit ListPage(const std::string &path) : path_(path) {}
+
+        // 返回当前模板，文件的修改时间或大小变化时重新加载；读取失败时沿用旧模板，没有旧模板返回空
+        TemplatePtr Load() {
+            struct stat st;
+            bool exists = stat(path_.c_str(), &st) == 0;
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (!exists || (tpl_ && st.st_mtim.tv_sec == mtime_.tv_sec &&
+                            st.st_mtim.tv_nsec == mtime_.tv_nsec && st.st_size == size_))
+                return tpl_;
+            std::string content;
+            if (!FileUtil(path_).GetContent(&content))
+                return tpl_;
+            tpl_ = Parse(content, ++generation_);
+            mtime_ = st.st_mtim;
+            size_ = st.st_size;
+            page_.reset();
+            mylog::GetLogger("asynclogger")->Info("load page template %s, generation %lu", path_.c_str(), generation_);
+            return tpl_;
+        }
+
+        Page Cached(uint64_t generation, uint64_t version) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (page_ && page_generation_ == generation && page_version_ == version)
+                return page_;
+            return Page();
+        }
+
+        // version应在读取数据之前取得，渲染期间数据有修改时缓存键已经过期，不会被命中
+        void Store(uint64_t generation, uint64_t version, Page page) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            if (generation != generation_)
+                return;
+            page_generation_ = generation;
+            page_version_ = version;
+            page_ = std::move(page);
+        }
+
+    private:
+        static TemplatePtr Parse(const std::string &content, uint64_t generation) {
+            std::shared_ptr<Template> tpl(new Template);
+            tpl->generation = generation;
+            size_t pos = 0;
+            for (;;)
+            {
+                size_t open = content.find("{{", pos);
+                size_t close = open == std::string::npos ? open : content.find("}}", open + 2);
+                if (close == std::string::npos)
+                    break;
+                tpl->texts.push_back(content.substr(pos, open - pos));
+                tpl->names.push_back(content.substr(open + 2, close - open - 2));
+                pos = close + 2;
+            }
+            tpl->texts.push_back(content.substr(pos));
+            return tpl;
+        }
+
+    private:
+        std::string path_;
+        std::mutex mtx_;
+        TemplatePtr tpl_;
+        uint64_t generation_ = 0;
+        struct timespec mtime_ = {0, 0};
+        off_t size_ = 0;
+        Page page_;
+        uint64_t page_generation_ = 0;
+        uint64_t page_version_ = 0;
+    };
+}
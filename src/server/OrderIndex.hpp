@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 只存条目下标的有序索引，两层的B+树：叶子是不超过kLeafMax个下标的有序数组，上层是叶子数组。
+// 下标本身不带排序值，比较由调用方传入(见CompactTable)。插入和删除先按叶子的最后一个元素二分找到叶子，
+// 再在叶子内二分，只移动叶子内的元素；叶子满了对半分裂，过小时和相邻叶子合并，
+// 所以每次修改的代价和索引大小基本无关，每个下标约占4~6字节
+namespace storage
+{
+    class OrderIndex
+    {
+    public:
+        // 索引中的位置，leaf == 叶子数时表示末尾
+        struct Pos
+        {
+            size_t leaf = 0;
+            size_t i = 0;
+        };
+
+        size_t Size() const { return size_; }
+
+        // 用已排好序的下标整体重建
+        void Build(const std::vector<uint32_t> &sorted) {
+            leaves_.clear();
+            for (size_t off = 0; off < sorted.size(); off += kLeafBuild)
+            {
+                size_t end = std::min(sorted.size(), off + kLeafBuild);
+                leaves_.emplace_back(sorted.begin() + off, sorted.begin() + end);
+            }
+            size_ = sorted.size();
+        }
+
+        // less(a, b)：下标a排在b之前
+        template <typename Less>
+        void Insert(uint32_t idx, Less less) {
+            ++size_;
+            if (leaves_.empty())
+            {
+                leaves_.emplace_back(1, idx);
+                return;
+            }
+            size_t leaf = FindLeaf(idx, less);
+            if (leaf == leaves_.size())
+                --leaf; // 比所有元素都靠后，放进最后一个叶子的末尾
+            std::vector<uint32_t> &v = leaves_[leaf];
+            v.insert(std::lower_bound(v.begin(), v.end(), idx, less), idx);
+            if (v.size() > kLeafMax)
+            {
+                std::vector<uint32_t> right(v.begin() + v.size() / 2, v.end());
+                std::vector<uint32_t>(v.begin(), v.begin() + v.size() / 2).swap(v);
+                leaves_.insert(leaves_.begin() + leaf + 1, std::move(right));
+            }
+        }
+
+        // idx必须在索引中，less按它当前的排序值定位
+        template <typename Less>
+        void Erase(uint32_t idx, Less less) {
+            Pos p = Find(idx, less);
+            std::vector<uint32_t> &v = leaves_[p.leaf];
+            v.erase(v.begin() + p.i);
+            --size_;
+            if (v.empty())
+                leaves_.erase(leaves_.begin() + p.leaf);
+            else if (p.leaf > 0 && leaves_[p.leaf - 1].size() + v.size() <= kLeafMax / 2)
+                Merge(p.leaf - 1);
+            else if (p.leaf + 1 < leaves_.size() && leaves_[p.leaf + 1].size() + v.size() <= kLeafMax / 2)
+                Merge(p.leaf);
+        }
+
+        // 把下标from原地换成to，调用方保证两者的排序值相同
+        template <typename Less>
+        void Retarget(uint32_t from, uint32_t to, Less less) {
+            Pos p = Find(from, less);
+            leaves_[p.leaf][p.i] = to;
+        }
+
+        // 第一个cmp(下标) >= 0 / > 0 的位置，cmp为该下标和要找的键比较的结果
+        template <typename Cmp>
+        Pos Lower(Cmp cmp) const {
+            return Bound([&cmp](uint32_t idx)
+                         { return cmp(idx) < 0; });
+        }
+        template <typename Cmp>
+        Pos Upper(Cmp cmp) const {
+            return Bound([&cmp](uint32_t idx)
+                         { return cmp(idx) <= 0; });
+        }
+
+        Pos Begin() const { return Pos(); }
+        Pos End() const {
+            Pos p;
+            p.leaf = leaves_.size();
+            return p;
+        }
+        uint32_t At(const Pos &p) const { return leaves_[p.leaf][p.i]; }
+        void Next(Pos *p) const {
+            if (++p->i == leaves_[p->leaf].size())
+            {
+                ++p->leaf;
+                p->i = 0;
+            }
+        }
+        void Prev(Pos *p) const {
+            if (p->i > 0)
+            {
+                --p->i;
+                return;
+            }
+            --p->leaf;
+            p->i = leaves_[p->leaf].size() - 1;
+        }
+        static bool Before(const Pos &a, const Pos &b) {
+            return a.leaf != b.leaf ? a.leaf < b.leaf : a.i < b.i;
+        }
+
+        // 占用的堆内存(按容量计)
+        size_t MemoryBytes() const {
+            size_t n = leaves_.capacity() * sizeof(std::vector<uint32_t>);
+            for (auto &v : leaves_)
+                n += v.capacity() * sizeof(uint32_t);
+            return n;
+        }
+
+    private:
+        static constexpr size_t kLeafMax = 1024;  // 超过就分裂
+        static constexpr size_t kLeafBuild = 768; // 整体重建时每个叶子的大小，留出插入的余地
+
+        // 第一个最后元素不排在idx之前的叶子，都排在idx之前时返回叶子数
+        template <typename Less>
+        size_t FindLeaf(uint32_t idx, Less &less) const {
+            return std::partition_point(leaves_.begin(), leaves_.end(), [&](const std::vector<uint32_t> &v)
+                                        { return less(v.back(), idx); }) -
+                   leaves_.begin();
+        }
+
+        template <typename Less>
+        Pos Find(uint32_t idx, Less &less) const {
+            Pos p;
+            p.leaf = FindLeaf(idx, less);
+            const std::vector<uint32_t> &v = leaves_[p.leaf];
+            p.i = std::lower_bound(v.begin(), v.end(), idx, less) - v.begin();
+            return p;
+        }
+
+        // 第一个before(下标)为false的位置，before在索引顺序上先真后假
+        template <typename Pred>
+        Pos Bound(Pred before) const {
+            Pos p;
+            p.leaf = std::partition_point(leaves_.begin(), leaves_.end(), [&](const std::vector<uint32_t> &v)
+                                          { return before(v.back()); }) -
+                     leaves_.begin();
+            if (p.leaf < leaves_.size())
+            {
+                const std::vector<uint32_t> &v = leaves_[p.leaf];
+                p.i = std::partition_point(v.begin(), v.end(), before) - v.begin();
+            }
+            return p;
+        }
+
+        // 把leaf+1并进leaf
+        void Merge(size_t leaf) {
+            std::vector<uint32_t> &v = leaves_[leaf];
+            v.insert(v.end(), leaves_[leaf + 1].begin(), leaves_[leaf + 1].end());
+            leaves_.erase(leaves_.begin() + leaf + 1);
+        }
+
+    private:
+        std::vector<std::vector<uint32_t>> leaves_;
+        size_t size_ = 0;
+    };
+}
@@ -1,16 +1,25 @@
 #pragma once
 #include "DataManager.hpp"
+#include "UploadStream.hpp"
+#include "AsyncTask.hpp"
+#include "DecompressCache.hpp"
+#include "ListPage.hpp"
 
 #include <sys/queue.h>
 #include <event.h>
 // for http
 #include <evhttp.h>
 #include <event2/http.h>
+#include <event2/thread.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <random>
 #include <regex>
+#include <thread>
+#include <unistd.h>
 
 #include "base64.h" // 来自 cpp-base64 库
 
@@ -27,56 +36,144 @@ namespace storage
             server_port_ = Config::GetInstance()->GetServerPort();
             server_ip_ = Config::GetInstance()->GetServerIp();
             download_prefix_ = Config::GetInstance()->GetDownloadPrefix();
+            backend_url_ = "http://" + server_ip_ + ":" + std::to_string(server_port_);
+            list_page_.reset(new ListPage("index.html"));
+            // 处理请求中阻塞操作和上传压缩的线程池，和日志系统的线程池分开，避免互相拖慢。
+            // 提交方都是reactor线程，提交只在锁内改两个指针、稳定后不分配内存，见WorkStealingPool
+            int workers = Config::GetInstance()->GetWorkerThreads();
+            if (workers <= 0)
+                workers = std::max(1u, std::thread::hardware_concurrency());
+            workers_.reset(new WorkStealingPool(workers));
+            cache_.reset(new DecompressCache(Config::GetInstance()->GetCacheDir(),
+                                             Config::GetInstance()->GetCacheCapacity()));
 #ifdef DEBUG_LOG
             mylog::GetLogger("asynclogger")->Debug("Service end(Construct)");
 #endif
         }
+        // 每个reactor线程各有一套event_base/evhttp，监听套接字通过SO_REUSEPORT
+        // 绑定在同一端口上，由内核把新连接分摊到各个线程
         bool RunModule() {
-            // 初始化环境
-            event_base *base = event_base_new();
-            if (base == NULL)
+            // 后台压缩线程需要跨线程激活事件
+            evthread_use_pthreads();
+            int threads = Config::GetInstance()->GetServiceThreads();
+            if (threads <= 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            // 内核不支持SO_REUSEPORT时退化为所有reactor共用一个监听套接字
+            int shared_fd = -1;
+            int probe = CreateListenSocket(true);
+            if (probe == -1)
             {
-                mylog::GetLogger("asynclogger")->Fatal("event_base_new err!");
-                return false;
+                shared_fd = CreateListenSocket(false);
+                if (shared_fd == -1)
+                {
+                    mylog::GetLogger("asynclogger")->Fatal("create listen socket failed!");
+                    return false;
+                }
+                mylog::GetLogger("asynclogger")->Warn("SO_REUSEPORT unavailable, reactors share one listen socket");
+            }
+            mylog::GetLogger("asynclogger")->Info("service start with %d reactor threads", threads);
+
+            std::vector<std::thread> reactors;
+            for (int i = 1; i < threads; ++i)
+            {
+                int fd = shared_fd == -1 ? CreateListenSocket(true) : dup(shared_fd);
+                reactors.emplace_back([this, fd, i]
+                                      { RunReactor(fd, i); });
+            }
+            bool ret = RunReactor(shared_fd == -1 ? probe : shared_fd, 0);
+            for (auto &t : reactors)
+                t.join();
+            return ret;
+        }
+
+    private:
+        // 创建已经listen的非阻塞套接字，reuseport为true时设置SO_REUSEPORT
+        int CreateListenSocket(bool reuseport) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("socket err: %s", strerror(errno));
+                return -1;
+            }
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+            {
+                mylog::GetLogger("asynclogger")->Warn("SO_REUSEPORT err: %s", strerror(errno));
+                close(fd);
+                return -1;
             }
             // 设置监听的端口和地址
             sockaddr_in sin;
             memset(&sin, 0, sizeof(sin));
             sin.sin_family = AF_INET;
+            sin.sin_addr.s_addr = htonl(INADDR_ANY);
             sin.sin_port = htons(server_port_);
+            if (bind(fd, (sockaddr *)&sin, sizeof(sin)) != 0 || listen(fd, SOMAXCONN) != 0)
+            {
+                mylog::GetLogger("asynclogger")->Error("bind/listen port %d err: %s", server_port_, strerror(errno));
+                close(fd);
+                return -1;
+            }
+            evutil_make_socket_nonblocking(fd);
+            return fd;
+        }
+
+        // 在当前线程运行一个reactor，fd由evhttp接管
+        bool RunReactor(int fd, int id) {
+            if (fd == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("reactor %d has no listen socket", id);
+                return false;
+            }
+            // 初始化环境
+            event_base *base = event_base_new();
+            if (base == NULL)
+            {
+                mylog::GetLogger("asynclogger")->Fatal("event_base_new err!");
+                close(fd);
+                return false;
+            }
             // http 服务器,创建evhttp上下文
             evhttp *httpd = evhttp_new(base);
-            // 绑定端口和ip
-            if (evhttp_bind_socket(httpd, "0.0.0.0", server_port_) != 0)
+            // 接管已经绑定好端口的套接字
+            if (evhttp_accept_socket(httpd, fd) != 0)
             {
-                mylog::GetLogger("asynclogger")->Fatal("evhttp_bind_socket failed!");
+                mylog::GetLogger("asynclogger")->Fatal("evhttp_accept_socket failed!");
+                close(fd);
+                evhttp_free(httpd);
+                event_base_free(base);
                 return false;
             }
             // 设定回调函数
             // 指定generic callback，也可以为特定的URI指定callback
-            evhttp_set_gencb(httpd, GenHandler, NULL);
+            evhttp_set_gencb(httpd, GenHandler, this);
+            // 每个连接套一层UploadStream，上传的请求体直接写入磁盘
+            evhttp_set_bevcb(httpd, UploadStream::NewConnection, workers_.get());
 
-            if (base)
-            {
 #ifdef DEBUG_LOG
-                mylog::GetLogger("asynclogger")->Debug("event_base_dispatch");
+            mylog::GetLogger("asynclogger")->Debug("reactor %d event_base_dispatch", id);
 #endif
-                if (-1 == event_base_dispatch(base))
-                {
-                    mylog::GetLogger("asynclogger")->Debug("event_base_dispatch err");
-                }
+            if (-1 == event_base_dispatch(base))
+            {
+                mylog::GetLogger("asynclogger")->Debug("event_base_dispatch err");
             }
-            if (base)
-                event_base_free(base);
-            if (httpd)
-                evhttp_free(httpd);
+            // evhttp依赖event_base，先释放evhttp
+            evhttp_free(httpd);
+            event_base_free(base);
             return true;
         }
 
-    private:
         uint16_t server_port_;
         std::string server_ip_;
         std::string download_prefix_;
+        static constexpr size_t kListPageSize = 100;  // 列表默认每页条数
+        static constexpr long kMaxListLimit = 1000;   // /api/list的limit上限
+        static constexpr size_t kRowsPerChunk = 32;   // 列表页面每段发送的行数
+        std::string backend_url_;                     // 页面中{{BACKEND_URL}}的值
+        std::unique_ptr<ListPage> list_page_;
+        std::unique_ptr<WorkStealingPool> workers_;
+        std::unique_ptr<DecompressCache> cache_;
 
     private:
         static void GenHandler(struct evhttp_request *req, void *arg) {
@@ -100,6 +197,11 @@ namespace storage
             {
                 Delete(req, arg);
             }
+            // 分页的文件列表接口，返回json
+            else if (path == "/api/list")
+            {
+                ApiList(req, arg);
+            }
             // 这里就是显示已存储文件列表，返回一个html页面给浏览器
             else if (path == "/")
             {
@@ -115,37 +217,57 @@ namespace storage
             mylog::GetLogger("asynclogger")->Info("Upload start");
             // 约定：请求中包含"low_storage"，说明请求中存在文件数据,并希望普通存储\
                 包含"deep_storage"字段则压缩后存储
-            // 获取请求体内容
-            struct evbuffer *buf = evhttp_request_get_input_buffer(req);
-            if (buf == nullptr)
+            // 请求体已经由UploadStream流式写入临时文件时，这里只需要改名/压缩。
+            // 临时文件路径和存储类型从本连接的过滤器中按编号取，请求头里只有编号
+            const char *streamed = evhttp_find_header(req->input_headers, UploadStream::kIdHeader);
+            UploadStream::Finished finished;
+            if (streamed != NULL && !UploadStream::Take(req, strtoull(streamed, nullptr, 10), &finished))
             {
-                mylog::GetLogger("asynclogger")->Info("evhttp_request_get_input_buffer is empty");
+                mylog::GetLogger("asynclogger")->Warn("no stream upload %s on this connection", streamed);
+                evhttp_send_reply(req, HTTP_BADREQUEST, "bad request", NULL);
                 return;
             }
-
-            size_t len = evbuffer_get_length(buf); // 获取请求体的长度
-            mylog::GetLogger("asynclogger")->Info("evbuffer_get_length is %u", len);
-            if (0 == len)
+            std::string temp_path = finished.temp_path;
+            if (streamed != NULL && temp_path.empty())
             {
-                evhttp_send_reply(req, HTTP_BADREQUEST, "file empty", NULL);
-                mylog::GetLogger("asynclogger")->Info("request body is empty");
+                mylog::GetLogger("asynclogger")->Error("stream upload failed");
+                evhttp_send_reply(req, HTTP_INTERNAL, "server error", NULL);
                 return;
             }
-            std::string content(len, 0);
-            if (-1 == evbuffer_copyout(buf, (void *)content.c_str(), len))
+            std::string content;
+            size_t len = 0;
+            if (streamed == NULL)
             {
-                mylog::GetLogger("asynclogger")->Error("evbuffer_copyout error");
-                evhttp_send_reply(req, HTTP_INTERNAL, NULL, NULL);
-                return;
+                // 获取请求体内容
+                struct evbuffer *buf = evhttp_request_get_input_buffer(req);
+                if (buf == nullptr)
+                {
+                    mylog::GetLogger("asynclogger")->Info("evhttp_request_get_input_buffer is empty");
+                    return;
+                }
+
+                len = evbuffer_get_length(buf); // 获取请求体的长度
+                mylog::GetLogger("asynclogger")->Info("evbuffer_get_length is %u", len);
+                if (0 == len)
+                {
+                    evhttp_send_reply(req, HTTP_BADREQUEST, "file empty", NULL);
+                    mylog::GetLogger("asynclogger")->Info("request body is empty");
+                    return;
+                }
+                content.resize(len);
+                if (-1 == evbuffer_copyout(buf, (void *)content.c_str(), len))
+                {
+                    mylog::GetLogger("asynclogger")->Error("evbuffer_copyout error");
+                    evhttp_send_reply(req, HTTP_INTERNAL, NULL, NULL);
+                    return;
+                }
             }
 
             // 获取文件名
-            std::string filename = evhttp_find_header(req->input_headers, "FileName");
-            // 解码文件名
-            filename = base64_decode(filename);
-
+            const char *filename_header = evhttp_find_header(req->input_headers, "FileName");
             // 获取存储类型，客户端自定义请求头 StorageType
-            std::string storage_type = evhttp_find_header(req->input_headers, "StorageType");
+            const char *storage_type_header = evhttp_find_header(req->input_headers, "StorageType");
+            std::string storage_type = streamed ? finished.storage_type : storage_type_header ? storage_type_header : "";
             // 组织存储路径
             std::string storage_path;
             if (storage_type == "low")
@@ -156,13 +278,48 @@ namespace storage
             {
                 storage_path = Config::GetInstance()->GetDeepStorageDir();
             }
-            else
+            if (storage_path.empty() || filename_header == NULL)
             {
                 mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: HTTP_BADREQUEST");
                 evhttp_send_reply(req, HTTP_BADREQUEST, "Illegal storage type", NULL);
+                if (!temp_path.empty())
+                    unlink(temp_path.c_str());
                 return;
             }
+            // 解码文件名
+            std::string filename = base64_decode(std::string(filename_header));
+            // 流式上传时由UploadStream边收边算好了内容哈希，和临时文件一起从连接上取得
+            uint64_t hash = streamed ? finished.hash : 0;
+
+            // 落盘、压缩和持久化都在工作线程中完成
+            auto body = std::make_shared<std::string>(std::move(content));
+            AsyncTask::Run(static_cast<Service *>(arg)->workers_.get(), req,
+                           [storage_path, filename, temp_path, hash, body](HttpReply *reply)
+                           { StoreUpload(storage_path, filename, temp_path, hash, *body, reply); });
+        }
+
+        // 整个请求体已经在内存中时，按和流式上传相同的分块格式写入path
+        static bool CompressBlocks(const std::string &content, const std::string &path) {
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1)
+            {
+                mylog::GetLogger("asynclogger")->Warn("open %s err: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            BlockEncoder encoder(fd, Config::GetInstance()->GetBundleFormat());
+            size_t block = Config::GetInstance()->GetDeepBlockSize();
+            for (size_t off = 0; off < content.size(); off += block)
+                encoder.Append(content.data() + off, std::min(block, content.size() - off));
+            bool ok = encoder.Finish();
+            close(fd);
+            return ok;
+        }
 
+        // 工作线程中执行：temp_path为空时body是完整的请求体，hash为0时在这里计算
+        static void StoreUpload(std::string storage_path, const std::string &filename, std::string temp_path,
+                                uint64_t hash, const std::string &content, HttpReply *reply) {
+            if (temp_path.empty())
+                hash = ContentHash::Of(content.data(), content.size());
             // 如果不存在就创建low或deep目录
             FileUtil dirCreate(storage_path);
             dirCreate.CreateDirectory();
@@ -173,14 +330,24 @@ namespace storage
             mylog::GetLogger("asynclogger")->Debug("storage_path:%s", storage_path.c_str());
 #endif
 
-            // 看路径里是low还是deep存储，是deep就压缩，是low就直接写入
-            FileUtil fu(storage_path);
+            // 看路径里是low还是deep存储，是deep就压缩，是low就直接写入。
+            // 都先写到同目录下的临时文件再rename，读者不会看到写了一半的文件；
+            // 同一目录中已经存过相同内容时只链接到那份blob，不占新的磁盘
+            bool ok = true;
             if (storage_path.find("low_storage") != std::string::npos)
             {
-                if (fu.SetContent(content.c_str(), len) == false)
+                bool linked = temp_path.empty() && BlobStore::LinkExisting(storage_path, hash, content, false);
+                if (temp_path.empty() && !linked)
+                {
+                    temp_path = BlobStore::TempPath(storage_path, "body");
+                    ok = FileUtil(temp_path).SetContent(content.c_str(), content.size());
+                }
+                ok = ok && (linked || BlobStore::Commit(temp_path, storage_path, hash));
+                if (ok == false)
                 {
                     mylog::GetLogger("asynclogger")->Error("low_storage fail, evhttp_send_reply: HTTP_INTERNAL");
-                    evhttp_send_reply(req, HTTP_INTERNAL, "server error", NULL);
+                    reply->code = HTTP_INTERNAL;
+                    reply->reason = "server error";
                     return;
                 }
                 else
@@ -190,10 +357,19 @@ namespace storage
             }
             else
             {
-                if (fu.Compress(content, Config::GetInstance()->GetBundleFormat()) == false)
+                // 流式上传时临时文件已经是分块压缩好的；请求体在内存中且已有相同内容时不用再压缩
+                bool linked = temp_path.empty() && BlobStore::LinkExisting(storage_path, hash, content, true);
+                if (temp_path.empty() && !linked)
+                {
+                    temp_path = BlobStore::TempPath(storage_path, "body");
+                    ok = CompressBlocks(content, temp_path);
+                }
+                ok = ok && (linked || BlobStore::Commit(temp_path, storage_path, hash));
+                if (ok == false)
                 {
                     mylog::GetLogger("asynclogger")->Error("deep_storage fail, evhttp_send_reply: HTTP_INTERNAL");
-                    evhttp_send_reply(req, HTTP_INTERNAL, "server error", NULL);
+                    reply->code = HTTP_INTERNAL;
+                    reply->reason = "server error";
                     return;
                 }
                 else
@@ -204,10 +380,25 @@ namespace storage
 
             // 添加存储文件信息，交由数据管理类进行管理
             StorageInfo info;
-            info.NewStorageInfo(storage_path); // 组织存储的文件信息
-            data_->Insert(info);               // 向数据管理模块添加存储的文件信息
+            bool stored = info.NewStorageInfo(storage_path); // 组织存储的文件信息
+            info.hash_ = hash;
+            // 链接到已有blob的文件，mtime是blob最初写入的时间，统一记为这次上传完成的时间
+            info.mtime_ = info.atime_ = time(nullptr);
+            // 向数据管理模块添加存储的文件信息。名字太长放不进表或日志写失败时，
+            // 删掉刚提交的文件，不留下表里没有的孤儿文件
+            if (!stored || !data_->Insert(info))
+            {
+                unlink(storage_path.c_str());
+                BlobStore::Release(info);
+                bool too_long = stored && !CompactTable::Fits(info);
+                mylog::GetLogger("asynclogger")->Error("upload insert fail: %s", storage_path.c_str());
+                reply->code = too_long ? HTTP_BADREQUEST : HTTP_INTERNAL;
+                reply->reason = too_long ? "file name too long" : "server error";
+                return;
+            }
 
-            evhttp_send_reply(req, HTTP_OK, "Success", NULL);
+            reply->code = HTTP_OK;
+            reply->reason = "Success";
             mylog::GetLogger("asynclogger")->Info("upload finish:success");
         }
 
@@ -221,83 +412,126 @@ namespace storage
         }
 
         // 前端代码处理函数
-        // 在渲染函数中直接处理StorageInfo
-        static std::string generateModernFileList(const std::vector<StorageInfo> &files) {
-            std::stringstream ss;
-            
-            // 如果没有文件，显示空状态
-            if (files.empty()) {
-                ss << "<div class=\"empty-state\">";
-                ss << "<i class=\"fas fa-folder-open\"></i>";
-                ss << "<h3>暂无文件</h3>";
-                ss << "<p>上传文件后将显示在此处</p>";
-                ss << "</div>";
-                return ss.str();
-            }
+        // 没有文件时显示的空状态
+        static void generateEmptyState(std::string *out) {
+            out->append("<div class=\"empty-state\">");
+            out->append("<i class=\"fas fa-folder-open\"></i>");
+            out->append("<h3>暂无文件</h3>");
+            out->append("<p>上传文件后将显示在此处</p>");
+            out->append("</div>");
+        }
 
-            // 有文件时，生成文件列表
-            for (const auto &file : files)
+        // 在渲染函数中直接处理StorageInfo，生成一个文件条目追加到out
+        static void generateFileItem(const StorageInfo &file, std::string *out) {
+            std::string filename = FileUtil(file.storage_path_).FileName();
+
+            // 从路径中解析存储类型
+            std::string storage_type = "low";
+            if (file.storage_path_.find("deep") != std::string::npos)
             {
-                std::string filename = FileUtil(file.storage_path_).FileName();
+                storage_type = "deep";
+            }
 
-                // 从路径中解析存储类型
-                std::string storage_type = "low";
-                if (file.storage_path_.find("deep") != std::string::npos)
-                {
-                    storage_type = "deep";
-                }
+            // 根据文件扩展名选择合适的图标
+            std::string file_icon = "fa-file";
+            size_t dot_pos = filename.find_last_of(".");
+            if (dot_pos != std::string::npos) {
+                std::string ext = filename.substr(dot_pos + 1);
+                if (ext == "pdf") file_icon = "fa-file-pdf";
+                else if (ext == "doc" || ext == "docx") file_icon = "fa-file-word";
+                else if (ext == "xls" || ext == "xlsx") file_icon = "fa-file-excel";
+                else if (ext == "ppt" || ext == "pptx") file_icon = "fa-file-powerpoint";
+                else if (ext == "zip" || ext == "rar" || ext == "7z" || ext == "tar" || ext == "gz") file_icon = "fa-file-archive";
+                else if (ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "gif" || ext == "bmp" || ext == "svg") file_icon = "fa-file-image";
+                else if (ext == "mp3" || ext == "wav" || ext == "ogg" || ext == "flac") file_icon = "fa-file-audio";
+                else if (ext == "mp4" || ext == "avi" || ext == "mov" || ext == "wmv" || ext == "mkv") file_icon = "fa-file-video";
+                else if (ext == "txt" || ext == "log" || ext == "md") file_icon = "fa-file-alt";
+                else if (ext == "html" || ext == "htm" || ext == "xml" || ext == "json" || ext == "js" || ext == "css") file_icon = "fa-file-code";
+            }
 
-                // 根据文件扩展名选择合适的图标
-                std::string file_icon = "fa-file";
-                size_t dot_pos = filename.find_last_of(".");
-                if (dot_pos != std::string::npos) {
-                    std::string ext = filename.substr(dot_pos + 1);
-                    if (ext == "pdf") file_icon = "fa-file-pdf";
-                    else if (ext == "doc" || ext == "docx") file_icon = "fa-file-word";
-                    else if (ext == "xls" || ext == "xlsx") file_icon = "fa-file-excel";
-                    else if (ext == "ppt" || ext == "pptx") file_icon = "fa-file-powerpoint";
-                    else if (ext == "zip" || ext == "rar" || ext == "7z" || ext == "tar" || ext == "gz") file_icon = "fa-file-archive";
-                    else if (ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "gif" || ext == "bmp" || ext == "svg") file_icon = "fa-file-image";
-                    else if (ext == "mp3" || ext == "wav" || ext == "ogg" || ext == "flac") file_icon = "fa-file-audio";
-                    else if (ext == "mp4" || ext == "avi" || ext == "mov" || ext == "wmv" || ext == "mkv") file_icon = "fa-file-video";
-                    else if (ext == "txt" || ext == "log" || ext == "md") file_icon = "fa-file-alt";
-                    else if (ext == "html" || ext == "htm" || ext == "xml" || ext == "json" || ext == "js" || ext == "css") file_icon = "fa-file-code";
-                }
+            // 格式化时间
+            std::string time_str = TimetoStr(file.mtime_);
 
-                // 格式化时间
-                std::string time_str = TimetoStr(file.mtime_);
-                // 移除末尾的换行符
-                if (!time_str.empty() && time_str[time_str.length() - 1] == '\n') {
-                    time_str = time_str.substr(0, time_str.length() - 1);
-                }
+            out->append("<div class=\"file-item\">");
 
-                ss << "<div class=\"file-item\">";
-                
-                // 文件图标
-                ss << "<div class=\"file-icon\"><i class=\"fas " << file_icon << "\"></i></div>";
-                
-                // 文件信息
-                ss << "<div class=\"file-info\">";
-                ss << "<div class=\"file-name\">" << filename << "</div>";
-                ss << "<div class=\"file-details\">";
-                ss << "<span><i class=\"fas fa-hdd\"></i> " << (storage_type == "deep" ? "深度存储" : "普通存储") << "</span>";
-                ss << "<span><i class=\"fas fa-weight-hanging\"></i> " << formatSize(file.fsize_) << "</span>";
-                ss << "<span><i class=\"fas fa-clock\"></i> " << time_str << "</span>";
-                ss << "</div>";
-                ss << "</div>";
-                
-                // 文件操作
-                ss << "<div class=\"file-actions\">";
-                ss << "<button class=\"action-btn btn-success\" onclick=\"downloadFile('" << file.url_ << "')\"><i class=\"fas fa-download\"></i> 下载</button>";
-                ss << "<button class=\"action-btn btn-danger\" onclick=\"deleteFile('" << file.url_ << "', '" << filename << "')\"><i class=\"fas fa-trash-alt\"></i> 删除</button>";
-                ss << "</div>";
-                
-                ss << "</div>";
-            }
+            // 文件图标
+            out->append("<div class=\"file-icon\"><i class=\"fas ").append(file_icon).append("\"></i></div>");
 
-            return ss.str();
+            // 文件信息
+            out->append("<div class=\"file-info\">");
+            out->append("<div class=\"file-name\">").append(filename).append("</div>");
+            out->append("<div class=\"file-details\">");
+            out->append("<span><i class=\"fas fa-hdd\"></i> ").append(storage_type == "deep" ? "深度存储" : "普通存储").append("</span>");
+            out->append("<span><i class=\"fas fa-weight-hanging\"></i> ").append(formatSize(file.fsize_)).append("</span>");
+            out->append("<span><i class=\"fas fa-clock\"></i> ").append(time_str).append("</span>");
+            out->append("</div>");
+            out->append("</div>");
+
+            // 文件操作
+            out->append("<div class=\"file-actions\">");
+            out->append("<button class=\"action-btn btn-success\" onclick=\"downloadFile('").append(file.url_).append("')\"><i class=\"fas fa-download\"></i> 下载</button>");
+            out->append("<button class=\"action-btn btn-danger\" onclick=\"deleteFile('").append(file.url_).append("', '").append(filename).append("')\"><i class=\"fas fa-trash-alt\"></i> 删除</button>");
+            out->append("</div>");
+
+            out->append("</div>");
         }
 
+        // 一次列表页面的流式渲染，Next每次生成一段，同一时间只有一个工作线程调用
+        struct ListRender
+        {
+            Service *service;
+            ListPage::TemplatePtr tpl;
+            uint64_t version; // 读取数据之前的DataManager版本
+            std::vector<StorageInfo> files;
+            std::string total;
+            std::string cursor;
+            size_t step = 0;  // 偶数为第step/2段文本，奇数为第step/2个占位符
+            size_t row = 0;   // FILE_LIST已经渲染的行数
+            std::string page; // 已生成的全部内容，结束时存入缓存
+
+            bool Next(std::string *chunk) {
+                size_t steps = tpl->texts.size() * 2 - 1;
+                while (step < steps)
+                {
+                    size_t i = step / 2;
+                    if (step % 2 == 0)
+                    {
+                        chunk->append(tpl->texts[i]);
+                        ++step;
+                        continue;
+                    }
+                    const std::string &name = tpl->names[i];
+                    if (name == "FILE_LIST" && !files.empty())
+                    {
+                        // 列表之前的部分先发出去，浏览器可以提前加载样式
+                        if (row == 0 && !chunk->empty())
+                            break;
+                        size_t end = std::min(files.size(), row + kRowsPerChunk);
+                        for (; row < end; ++row)
+                            generateFileItem(files[row], chunk);
+                        if (row == files.size())
+                            ++step;
+                        break;
+                    }
+                    if (name == "FILE_LIST")
+                        generateEmptyState(chunk);
+                    else if (name == "FILE_TOTAL")
+                        chunk->append(total);
+                    else if (name == "NEXT_CURSOR")
+                        chunk->append(cursor);
+                    else if (name == "BACKEND_URL")
+                        chunk->append(service->backend_url_);
+                    else
+                        chunk->append("{{").append(name).append("}}");
+                    ++step;
+                }
+                page.append(*chunk);
+                if (chunk->empty())
+                    service->list_page_->Store(tpl->generation, version, std::make_shared<const std::string>(std::move(page)));
+                return true;
+            }
+        };
+
         // 文件大小格式化函数
         static std::string formatSize(uint64_t bytes) {
             const char *units[] = {"B", "KB", "MB", "GB"};
@@ -314,66 +548,240 @@ namespace storage
             ss << std::fixed << std::setprecision(2) << size << " " << units[unit_index];
             return ss.str();
         }
+        // 文件列表页面。数据和模板都没变时直接返回缓存的页面；
+        // 否则边渲染边用chunked编码发送，同时把完整页面存进缓存
         static void ListShow(struct evhttp_request *req, void *arg) {
             mylog::GetLogger("asynclogger")->Info("ListShow()");
-            // 1. 获取所有的文件存储信息
-            std::vector<StorageInfo> arry;
-            data_->GetAll(&arry);
-
-            // 读取模板文件
-            std::ifstream templateFile("index.html");
-            std::string templateContent(
-                (std::istreambuf_iterator<char>(templateFile)),
-                std::istreambuf_iterator<char>());
-
-            // 替换html文件中的占位符
-            //替换文件列表进html
-            templateContent = std::regex_replace(templateContent,
-                                                 std::regex("\\{\\{FILE_LIST\\}\\}"),
-                                                 generateModernFileList(arry));
-            //替换服务器地址进hrml
-            templateContent = std::regex_replace(templateContent,
-                                                 std::regex("\\{\\{BACKEND_URL\\}\\}"),
-                                                "http://"+storage::Config::GetInstance()->GetServerIp()+":"+std::to_string(storage::Config::GetInstance()->GetServerPort()));
-            // 获取请求的输出evbuffer
-            struct evbuffer *buf = evhttp_request_get_output_buffer(req);
-            auto response_body = templateContent;
-            // 把前面的html数据给到evbuffer，然后设置响应头部字段，最后返回给浏览器
-            evbuffer_add(buf, (const void *)response_body.c_str(), response_body.size());
-            evhttp_add_header(req->output_headers, "Content-Type", "text/html;charset=utf-8");
-            evhttp_send_reply(req, HTTP_OK, NULL, NULL);
-            mylog::GetLogger("asynclogger")->Info("ListShow() finish");
+            Service *service = static_cast<Service *>(arg);
+            AsyncTask::Run(service->workers_.get(), req, [service](HttpReply *reply)
+                           {
+                reply->AddHeader("Content-Type", "text/html;charset=utf-8");
+                ListPage::TemplatePtr tpl = service->list_page_->Load();
+                if (!tpl)
+                {
+                    mylog::GetLogger("asynclogger")->Warn("ListShow: no page template");
+                    reply->code = HTTP_INTERNAL;
+                    reply->reason = "Server Error";
+                    return;
+                }
+                // 先取版本再读数据，渲染期间有修改时这份结果的版本已过期，不会被当作最新的命中
+                uint64_t version = data_->Version();
+                ListPage::Page page = service->list_page_->Cached(tpl->generation, version);
+                if (page)
+                {
+                    reply->body = *page;
+                    return;
+                }
+
+                // 页面只渲染第一页，后面的由页面通过/api/list按同样的排序加载
+                std::shared_ptr<ListRender> render(new ListRender);
+                render->service = service;
+                render->tpl = tpl;
+                render->version = version;
+                ListIndex::Query q;
+                q.sort = ListIndex::Sort::MTIME;
+                q.desc = true;
+                q.limit = kListPageSize;
+                std::string next;
+                data_->List(q, &render->files, &next);
+                render->total = std::to_string(data_->Size());
+                // 游标放进<script>里，转成json字符串，'<'转义以免提前结束脚本
+                Json::StreamWriterBuilder swb;
+                swb["emitUTF8"] = true;
+                for (char c : Json::writeString(swb, Json::Value(next)))
+                    render->cursor += c == '<' ? std::string("\\u003c") : std::string(1, c);
+                reply->producer = [render](std::string *chunk)
+                { return render->Next(chunk); };
+                mylog::GetLogger("asynclogger")->Info("ListShow() render %zu files", render->files.size()); });
         }
+
+        // 分页列出已存储的文件：
+        // GET /api/list?sort=name|mtime|size&order=asc|desc&prefix=文件名前缀&limit=N&cursor=上一页的next_cursor
+        // 翻页时其余参数要和第一页相同，next_cursor为空表示没有下一页
+        static void ApiList(struct evhttp_request *req, void *arg) {
+            Service *service = static_cast<Service *>(arg);
+            ListIndex::Query q;
+            if (!ParseListQuery(req, service->download_prefix_, &q))
+            {
+                evhttp_send_reply(req, HTTP_BADREQUEST, "Bad Request: invalid list parameters", NULL);
+                return;
+            }
+            AsyncTask::Run(service->workers_.get(), req, [q](HttpReply *reply)
+                           {
+                std::vector<StorageInfo> arry;
+                std::string next;
+                if (!data_->List(q, &arry, &next))
+                {
+                    reply->code = HTTP_BADREQUEST;
+                    reply->reason = "Bad Request: invalid cursor";
+                    return;
+                }
+                Json::Value root;
+                Json::Value &files = root["files"];
+                files = Json::Value(Json::arrayValue);
+                for (auto &e : arry)
+                {
+                    Json::Value item;
+                    item["url"] = e.url_;
+                    item["name"] = FileUtil(e.storage_path_).FileName();
+                    item["size"] = (Json::UInt64)e.fsize_;
+                    item["mtime"] = (Json::Int64)e.mtime_;
+                    item["storage"] = e.storage_path_.find("deep") != std::string::npos ? "deep" : "low";
+                    files.append(item);
+                }
+                root["next_cursor"] = next;
+                root["total"] = (Json::UInt64)data_->Size();
+                Json::StreamWriterBuilder swb;
+                swb["emitUTF8"] = true;
+                swb["indentation"] = "";
+                reply->body = Json::writeString(swb, root);
+                reply->AddHeader("Content-Type", "application/json;charset=utf-8"); });
+        }
+
+        static bool ParseListQuery(struct evhttp_request *req, const std::string &download_prefix, ListIndex::Query *q) {
+            struct evkeyvalq params;
+            if (evhttp_parse_query(evhttp_request_get_uri(req), &params) != 0)
+                return false;
+            bool ok = true;
+            const char *v = evhttp_find_header(&params, "sort");
+            std::string sort = v ? v : "name";
+            if (sort == "name")
+                q->sort = ListIndex::Sort::NAME;
+            else if (sort == "mtime")
+                q->sort = ListIndex::Sort::MTIME;
+            else if (sort == "size")
+                q->sort = ListIndex::Sort::SIZE;
+            else
+                ok = false;
+            v = evhttp_find_header(&params, "order");
+            std::string order = v ? v : "asc";
+            ok = ok && (order == "asc" || order == "desc");
+            q->desc = order == "desc";
+            // 前缀针对文件名，索引里存的是URL
+            v = evhttp_find_header(&params, "prefix");
+            q->prefix = download_prefix + (v ? v : "");
+            v = evhttp_find_header(&params, "cursor");
+            q->cursor = v ? v : "";
+            v = evhttp_find_header(&params, "limit");
+            if (v != NULL)
+            {
+                char *end = nullptr;
+                long limit = strtol(v, &end, 10);
+                ok = ok && *v != '\0' && *end == '\0' && limit > 0;
+                q->limit = std::min<long>(std::max(limit, 1L), kMaxListLimit);
+            }
+            else
+                q->limit = kListPageSize;
+            evhttp_clear_headers(&params);
+            return ok;
+        }
+
+        static bool IsWeakETag(const std::string &etag) {
+            return etag.compare(0, 2, "W/") == 0;
+        }
+
+        // 上传时算出了内容哈希的用强ETag，内容相同ETag就相同；
+        // 旧版本上传的文件没有哈希，退回到filename-fsize-mtime的弱ETag
         static std::string GetETag(const StorageInfo &info) {
-            // 自定义etag :  filename-fsize-mtime
+            if (info.hash_ != 0)
+                return "\"" + ContentHash::Hex(info.hash_) + "\"";
             FileUtil fu(info.storage_path_);
-            std::string etag = fu.FileName();
+            std::string etag = "W/\"" + fu.FileName();
             etag += "-";
             etag += std::to_string(info.fsize_);
             etag += "-";
             etag += std::to_string(info.mtime_);
+            etag += "\"";
             return etag;
         }
+        // If-None-Match按弱比较：列表中有一个去掉W/后和etag相同，或者为*
+        static bool NoneMatchHit(const std::string &if_none_match, const std::string &etag) {
+            std::string opaque = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+            size_t pos = 0;
+            while (pos < if_none_match.size())
+            {
+                size_t comma = if_none_match.find(',', pos);
+                if (comma == std::string::npos)
+                    comma = if_none_match.size();
+                size_t b = if_none_match.find_first_not_of(" \t", pos);
+                size_t e = if_none_match.find_last_not_of(" \t", comma - 1);
+                pos = comma + 1;
+                if (b == std::string::npos || b >= comma)
+                    continue;
+                std::string tag = if_none_match.substr(b, e - b + 1);
+                if (tag == "*")
+                    return true;
+                if (tag.compare(0, 2, "W/") == 0)
+                    tag = tag.substr(2);
+                if (tag == opaque)
+                    return true;
+            }
+            return false;
+        }
+        // 下载响应的缓存验证头
+        static void SetValidators(HttpReply *reply, const StorageInfo &info) {
+            reply->AddHeader("ETag", GetETag(info));
+            reply->AddHeader("Cache-Control", Config::GetInstance()->GetCacheControl());
+        }
         static void Download(struct evhttp_request *req, void *arg) {
             // 1. 获取客户端请求的资源路径path   req.path
-            // 2. 根据资源路径，获取StorageInfo
-            StorageInfo info;
             std::string resource_path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
             resource_path = UrlDecode(resource_path);
-            data_->GetOneByURL(resource_path, &info);
             mylog::GetLogger("asynclogger")->Info("request resource_path:%s", resource_path.c_str());
+            auto if_range = evhttp_find_header(req->input_headers, "If-Range");
+            std::string old_etag = if_range ? if_range : "";
+            bool has_if_range = if_range != NULL;
+            auto if_none_match_header = evhttp_find_header(req->input_headers, "If-None-Match");
+            std::string if_none_match = if_none_match_header ? if_none_match_header : "";
+            auto range_header = evhttp_find_header(req->input_headers, "Range");
+            std::string range = range_header ? range_header : "";
+            // 查表、解压和打开文件都在工作线程中完成
+            Service *self = static_cast<Service *>(arg);
+            DecompressCache *cache = self->cache_.get();
+            AsyncTask::Run(self->workers_.get(), req,
+                           [cache, resource_path, old_etag, has_if_range, range, if_none_match](HttpReply *reply)
+                           { PrepareDownload(cache, resource_path, has_if_range, old_etag, range, if_none_match, reply); });
+        }
+
+        // 工作线程中执行：打开要发送的文件，fd交给reply在事件循环中发送
+        static void PrepareDownload(DecompressCache *cache, const std::string &resource_path, bool has_if_range,
+                                    const std::string &old_etag, const std::string &range,
+                                    const std::string &if_none_match, HttpReply *reply) {
+            // 2. 根据资源路径，获取StorageInfo
+            StorageInfo info;
+            if (data_->GetOneByURL(resource_path, &info) == false)
+            {
+                mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: 400 - bad request,file not exists");
+                reply->code = HTTP_BADREQUEST;
+                reply->reason = "file not exists";
+                return;
+            }
+
+            // 客户端缓存的内容仍是最新的，不发送响应体
+            if (!if_none_match.empty() && NoneMatchHit(if_none_match, GetETag(info)))
+            {
+                SetValidators(reply, info);
+                reply->code = HTTP_NOTMODIFIED;
+                reply->reason = "Not Modified";
+                return;
+            }
+
+            // If-Range不匹配时按RFC 7233返回整个文件；带索引的分块文件可以只解压Range涉及的块。
+            // If-Range要求强比较，任何一方是弱ETag都不算匹配
+            std::string etag = GetETag(info);
+            bool want_range = !range.empty() &&
+                              (!has_if_range || (old_etag == etag && !IsWeakETag(etag)));
+            bool is_deep = info.storage_path_.find(Config::GetInstance()->GetLowStorageDir()) == std::string::npos;
+            if (is_deep && want_range && StreamDeepRange(info, range, reply))
+                return;
 
             std::string download_path = info.storage_path_;
-            // 2.如果压缩过了就解压到新文件给用户下载
-            if (info.storage_path_.find(Config::GetInstance()->GetLowStorageDir()) == std::string::npos)
+            // 2.如果压缩过了就从解压缓存中取，并发请求同一个文件时只解压一次
+            DecompressCache::Handle cached;
+            if (is_deep)
             {
-                mylog::GetLogger("asynclogger")->Info("uncompressing:%s", info.storage_path_.c_str());
-                FileUtil fu(info.storage_path_);
-                download_path = Config::GetInstance()->GetLowStorageDir() +
-                                std::string(download_path.begin() + download_path.find_last_of('/') + 1, download_path.end());
-                FileUtil dirCreate(Config::GetInstance()->GetLowStorageDir());
-                dirCreate.CreateDirectory();
-                fu.UnCompress(download_path); // 将文件解压到low_storage下去或者再创一个文件夹做中转
+                cached = cache->Acquire(info);
+                download_path = cached ? *cached : "";
             }
             mylog::GetLogger("asynclogger")->Info("request download_path:%s", download_path.c_str());
             FileUtil fu(download_path);
@@ -381,69 +789,230 @@ namespace storage
             {
                 // 如果是压缩文件，且解压失败，是服务端的错误
                 mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: 500 - UnCompress failed");
-                evhttp_send_reply(req, HTTP_INTERNAL, NULL, NULL);
+                reply->code = HTTP_INTERNAL;
+                return;
             }
             else if (fu.Exists() == false && info.storage_path_.find("low_storage") == std::string::npos)
             {
                 // 如果是普通文件，且文件不存在，是客户端的错误
                 mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: 400 - bad request,file not exists");
-                evhttp_send_reply(req, HTTP_BADREQUEST, "file not exists", NULL);
-            }
-
-            // 3.确认文件是否需要断点续传
-            bool retrans = false;
-            std::string old_etag;
-            auto if_range = evhttp_find_header(req->input_headers, "If-Range");
-            if (NULL != if_range)
-            {
-                old_etag = if_range;
-                // 有If-Range字段且，这个字段的值与请求文件的最新etag一致则符合断点续传
-                if (old_etag == GetETag(info))
-                {
-                    retrans = true;
-                    mylog::GetLogger("asynclogger")->Info("%s need breakpoint continuous transmission", download_path.c_str());
-                }
+                reply->code = HTTP_BADREQUEST;
+                reply->reason = "file not exists";
+                return;
             }
 
-            // 4. 读取文件数据，放入rsp.body中
+            // 3. 打开文件，由事件循环把文件内容放入响应体
             if (fu.Exists() == false)
             {
                 mylog::GetLogger("asynclogger")->Info("%s not exists", download_path.c_str());
-                download_path += "not exists";
-                evhttp_send_reply(req, 404, download_path.c_str(), NULL);
+                reply->code = HTTP_NOTFOUND;
+                reply->reason = download_path + "not exists";
                 return;
             }
-            evbuffer *outbuf = evhttp_request_get_output_buffer(req);
             int fd = open(download_path.c_str(), O_RDONLY);
             if (fd == -1)
             {
                 mylog::GetLogger("asynclogger")->Error("open file error: %s -- %s", download_path.c_str(), strerror(errno));
-                evhttp_send_reply(req, HTTP_INTERNAL, strerror(errno), NULL);
+                reply->code = HTTP_INTERNAL;
+                reply->reason = strerror(errno);
                 return;
             }
-            // 和前面用的evbuffer_add类似，但是效率更高，具体原因可以看函数声明
-            if (-1 == evbuffer_add_file(outbuf, fd, 0, fu.FileSize()))
+            uint64_t size = fu.FileSize();
+            // 4. 设置响应头部字段： ETag， Cache-Control， Accept-Ranges: bytes
+            reply->AddHeader("Accept-Ranges", "bytes");
+            SetValidators(reply, info);
+
+            // 5. 确认是否是区间请求(断点续传)，只发送请求的片段
+            std::vector<ByteRange> ranges;
+            int ret = want_range ? ParseRanges(range, size, &ranges) : 0;
+            if (ret < 0)
             {
-                mylog::GetLogger("asynclogger")->Error("evbuffer_add_file: %d -- %s -- %s", fd, download_path.c_str(), strerror(errno));
+                close(fd);
+                SetUnsatisfiable(reply, size);
+                return;
             }
-            // 5. 设置响应头部字段： ETag， Accept-Ranges: bytes
-            evhttp_add_header(req->output_headers, "Accept-Ranges", "bytes");
-            evhttp_add_header(req->output_headers, "ETag", GetETag(info).c_str());
-            evhttp_add_header(req->output_headers, "Content-Type", "application/octet-stream");
-            if (retrans == false)
+            reply->fd = fd;
+            reply->hold = cached; // 发送完之前缓存文件不会被淘汰
+            if (ret == 0)
             {
-                evhttp_send_reply(req, HTTP_OK, "Success", NULL);
+                reply->length = size;
+                reply->AddHeader("Content-Type", "application/octet-stream");
+                reply->code = HTTP_OK;
+                reply->reason = "Success";
                 mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: HTTP_OK");
+                return;
+            }
+            std::vector<std::string> heads = SetRangeHeaders(reply, ranges, size);
+            if (heads.empty())
+            {
+                reply->offset = ranges[0].first;
+                reply->length = ranges[0].second - ranges[0].first + 1;
+            }
+            else
+            {
+                // 多区间：整个文件作为一个文件段，各片段引用其中的一部分
+                reply->length = size;
+                for (size_t i = 0; i < ranges.size(); ++i)
+                    reply->parts.push_back(HttpReply::Part{heads[i], (ev_off_t)ranges[i].first,
+                                                           (ev_off_t)(ranges[i].second - ranges[i].first + 1)});
+                reply->parts.push_back(HttpReply::Part{heads.back(), 0, 0});
+            }
+            mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: 206, %zu ranges", ranges.size());
+        }
+
+        using ByteRange = std::pair<uint64_t, uint64_t>; // 闭区间
+        static constexpr size_t kMaxRanges = 32;
+
+        // 解析Range头，结果按起点排序并合并重叠的区间。
+        // 返回1表示可以按区间响应，0表示忽略Range返回整个文件，-1表示区间都不可满足(416)
+        static int ParseRanges(const std::string &header, uint64_t size, std::vector<ByteRange> *ranges) {
+            static const std::regex re("^\\s*(\\d{0,19})-(\\d{0,19})\\s*$");
+            if (header.compare(0, 6, "bytes=") != 0)
+                return 0;
+            std::vector<std::string> specs;
+            std::stringstream ss(header.substr(6));
+            std::string spec;
+            while (std::getline(ss, spec, ','))
+                specs.push_back(spec);
+            if (specs.empty() || specs.size() > kMaxRanges)
+                return 0;
+            for (auto &s : specs)
+            {
+                std::smatch m;
+                if (!std::regex_match(s, m, re) || (m[1].length() == 0 && m[2].length() == 0))
+                    return 0;
+                if (m[1].length() == 0)
+                {
+                    // -n：最后n个字节
+                    uint64_t n = std::stoull(m[2].str());
+                    if (n > 0 && size > 0)
+                        ranges->emplace_back(n >= size ? 0 : size - n, size - 1);
+                    continue;
+                }
+                uint64_t start = std::stoull(m[1].str());
+                uint64_t end = m[2].length() == 0 ? UINT64_MAX : std::stoull(m[2].str());
+                if (end < start)
+                    return 0;
+                if (start < size)
+                    ranges->emplace_back(start, std::min(end, size - 1));
+            }
+            if (ranges->empty())
+                return -1;
+            std::sort(ranges->begin(), ranges->end());
+            size_t n = 0;
+            for (size_t i = 1; i < ranges->size(); ++i)
+            {
+                if ((*ranges)[i].first <= (*ranges)[n].second + 1)
+                    (*ranges)[n].second = std::max((*ranges)[n].second, (*ranges)[i].second);
+                else
+                    (*ranges)[++n] = (*ranges)[i];
+            }
+            ranges->resize(n + 1);
+            return 1;
+        }
+
+        static void SetUnsatisfiable(HttpReply *reply, uint64_t size) {
+            reply->code = 416;
+            reply->reason = "Range Not Satisfiable";
+            reply->AddHeader("Content-Range", "bytes */" + std::to_string(size));
+        }
+
+        // 设置206的状态码和头部。单区间返回空；多区间(multipart/byteranges)返回每个片段前的分隔内容，
+        // 最后一项是结束分隔。Content-Length包含分隔内容
+        static std::vector<std::string> SetRangeHeaders(HttpReply *reply, const std::vector<ByteRange> &ranges, uint64_t size) {
+            reply->code = 206;
+            reply->reason = "Partial Content";
+            std::vector<std::string> heads;
+            uint64_t length = 0;
+            if (ranges.size() == 1)
+            {
+                reply->AddHeader("Content-Type", "application/octet-stream");
+                reply->AddHeader("Content-Range", "bytes " + std::to_string(ranges[0].first) + "-" +
+                                                      std::to_string(ranges[0].second) + "/" + std::to_string(size));
+                length = ranges[0].second - ranges[0].first + 1;
             }
             else
             {
-                evhttp_send_reply(req, 206, "breakpoint continuous transmission", NULL); // 区间请求响应的是206
-                mylog::GetLogger("asynclogger")->Info("evhttp_send_reply: 206");
+                static thread_local std::mt19937_64 rng(std::random_device{}());
+                char boundary[17];
+                snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)rng());
+                reply->AddHeader("Content-Type", std::string("multipart/byteranges; boundary=") + boundary);
+                for (size_t i = 0; i < ranges.size(); ++i)
+                {
+                    heads.push_back(std::string(i == 0 ? "" : "\r\n") + "--" + boundary +
+                                    "\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes " +
+                                    std::to_string(ranges[i].first) + "-" + std::to_string(ranges[i].second) + "/" +
+                                    std::to_string(size) + "\r\n\r\n");
+                    length += heads.back().size() + ranges[i].second - ranges[i].first + 1;
+                }
+                heads.push_back(std::string("\r\n--") + boundary + "--\r\n");
+                length += heads.back().size();
             }
-            if (download_path != info.storage_path_)
+            reply->AddHeader("Content-Length", std::to_string(length));
+            return heads;
+        }
+
+        // 工作线程中执行：按Range从带索引的deep文件中只解压涉及的块，边解压边发送。
+        // 旧格式文件或无法解析的Range返回false，由调用方按整个文件处理
+        static bool StreamDeepRange(const StorageInfo &info, const std::string &range, HttpReply *reply) {
+            auto reader = std::make_shared<BlockReader>();
+            if (!reader->Open(info.storage_path_))
+                return false;
+            uint64_t size = reader->RawSize();
+            std::vector<ByteRange> ranges;
+            int ret = ParseRanges(range, size, &ranges);
+            if (ret == 0)
+                return false;
+            reply->AddHeader("Accept-Ranges", "bytes");
+            SetValidators(reply, info);
+            if (ret < 0)
             {
-                remove(download_path.c_str()); // 删除文件
+                SetUnsatisfiable(reply, size);
+                return true;
             }
+            mylog::GetLogger("asynclogger")->Info("%s %zu ranges, blocks %lu-%lu", info.storage_path_.c_str(), ranges.size(),
+                                                  reader->FindBlock(ranges.front().first), reader->FindBlock(ranges.back().second));
+            std::vector<std::string> heads = SetRangeHeaders(reply, ranges, size);
+            // 依次输出：片段i的分隔内容、片段i的数据(每次最多一块)，最后是结束分隔
+            size_t i = 0;
+            uint64_t pos = 0;
+            bool head = true;
+            reply->producer = [reader, ranges, heads, i, pos, head](std::string *chunk) mutable
+            {
+                chunk->clear();
+                if (i == ranges.size())
+                {
+                    if (head && !heads.empty())
+                        *chunk = heads.back();
+                    head = false;
+                    return true;
+                }
+                if (head)
+                {
+                    head = false;
+                    pos = ranges[i].first;
+                    if (!heads.empty())
+                    {
+                        *chunk = heads[i];
+                        return true;
+                    }
+                }
+                size_t b = reader->FindBlock(pos);
+                std::string raw;
+                if (!reader->ReadBlock(b, &raw))
+                    return false;
+                uint64_t from = pos - reader->BlockStart(b);
+                uint64_t n = std::min<uint64_t>(raw.size() - from, ranges[i].second + 1 - pos);
+                chunk->assign(raw, from, n);
+                pos += n;
+                if (pos > ranges[i].second)
+                {
+                    ++i;
+                    head = true;
+                }
+                return true;
+            };
+            return true;
         }
 
         static void Delete(struct evhttp_request *req, void *arg) {
@@ -472,25 +1041,27 @@ namespace storage
             std::string url = file_url;
             mylog::GetLogger("asynclogger")->Info("Deleting file with URL: %s", url.c_str());
             
-            // 调用DataManager删除文件
-            bool success = data_->DeleteByURL(url);
             evhttp_clear_headers(&params);
-            
-            // 准备响应
-            struct evbuffer *buf = evhttp_request_get_output_buffer(req);
-            if (success) {
-                // 成功响应
-                evbuffer_add_printf(buf, "{\"status\": \"success\", \"message\": \"文件删除成功\"}");
-                evhttp_add_header(req->output_headers, "Content-Type", "application/json;charset=utf-8");
-                evhttp_send_reply(req, HTTP_OK, "Success", NULL);
-                mylog::GetLogger("asynclogger")->Info("Delete: Success");
-            } else {
-                // 失败响应
-                evbuffer_add_printf(buf, "{\"status\": \"error\", \"message\": \"文件删除失败\"}");
-                evhttp_add_header(req->output_headers, "Content-Type", "application/json;charset=utf-8");
-                evhttp_send_reply(req, HTTP_INTERNAL, "Server Error", NULL);
-                mylog::GetLogger("asynclogger")->Error("Delete: Failed");
-            }
+
+            // 调用DataManager删除文件，删除文件和持久化都在工作线程中完成
+            AsyncTask::Run(static_cast<Service *>(arg)->workers_.get(), req, [url](HttpReply *reply)
+                           {
+                bool success = data_->DeleteByURL(url);
+                // 准备响应
+                reply->AddHeader("Content-Type", "application/json;charset=utf-8");
+                if (success) {
+                    // 成功响应
+                    reply->body = "{\"status\": \"success\", \"message\": \"文件删除成功\"}";
+                    reply->code = HTTP_OK;
+                    reply->reason = "Success";
+                    mylog::GetLogger("asynclogger")->Info("Delete: Success");
+                } else {
+                    // 失败响应
+                    reply->body = "{\"status\": \"error\", \"message\": \"文件删除失败\"}";
+                    reply->code = HTTP_INTERNAL;
+                    reply->reason = "Server Error";
+                    mylog::GetLogger("asynclogger")->Error("Delete: Failed");
+                } });
         }
     };
 }
@@ -0,0 +1,197 @@
+#pragma once
+#include "StorageInfo.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 二进制元数据快照：文件头 + count条定长记录 + 字符串堆，记录里只存字符串在堆中的偏移和长度。
+// 加载时整个文件mmap进来，多个线程各解码一段记录，不需要任何解析
+namespace storage
+{
+    class Snapshot
+    {
+    public:
+        static constexpr const char *kMagic = "DSNP";
+        static constexpr uint32_t kVersion = 2; // 2在记录末尾加了内容哈希，1仍可加载
+
+        // 文件以kMagic开头才是二进制快照，否则按旧的JSON数组处理
+        static bool IsBinary(const std::string &path) {
+            char magic[4];
+            std::ifstream ifs(path.c_str(), std::ios::binary);
+            return ifs.read(magic, sizeof(magic)) && memcmp(magic, kMagic, sizeof(magic)) == 0;
+        }
+
+        // 把arr写入fd，落盘和改名由调用方负责
+        static bool Write(int fd, const std::vector<StorageInfo> &arr) {
+            Header h;
+            memcpy(h.magic, kMagic, sizeof(h.magic));
+            h.version = kVersion;
+            h.count = arr.size();
+            h.heap_offset = sizeof(Header) + arr.size() * sizeof(Record);
+            h.heap_size = 0;
+            for (auto &e : arr)
+                h.heap_size += e.url_.size() + e.storage_path_.size();
+
+            Writer w(fd);
+            w.Add(&h, sizeof(h));
+            uint64_t off = 0;
+            for (auto &e : arr)
+            {
+                Record r;
+                r.mtime = e.mtime_;
+                r.atime = e.atime_;
+                r.fsize = e.fsize_;
+                r.hash = e.hash_;
+                r.url_off = off;
+                r.url_len = e.url_.size();
+                off += r.url_len;
+                r.path_off = off;
+                r.path_len = e.storage_path_.size();
+                off += r.path_len;
+                w.Add(&r, sizeof(r));
+            }
+            for (auto &e : arr)
+            {
+                w.Add(e.url_.data(), e.url_.size());
+                w.Add(e.storage_path_.data(), e.storage_path_.size());
+            }
+            return w.Flush();
+        }
+
+        // 加载快照到arr，threads为0时按CPU核数
+        static bool Load(const std::string &path, std::vector<StorageInfo> *arr, unsigned threads = 0) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Header))
+            {
+                close(fd);
+                return false;
+            }
+            size_t size = st.st_size;
+            void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                return false;
+            madvise(addr, size, MADV_SEQUENTIAL);
+            const char *base = static_cast<const char *>(addr);
+            Header h;
+            memcpy(&h, base, sizeof(h));
+            size_t record_size = h.version == 1 ? kRecordSizeV1 : sizeof(Record);
+            bool ok = memcmp(h.magic, kMagic, sizeof(h.magic)) == 0 && h.version >= 1 && h.version <= kVersion &&
+                      h.heap_offset == sizeof(Header) + h.count * record_size &&
+                      h.heap_offset + h.heap_size == size;
+            if (ok)
+            {
+                const char *records = base + sizeof(Header);
+                const char *heap = base + h.heap_offset;
+                arr->resize(h.count);
+                if (threads == 0)
+                    threads = std::max(1u, std::thread::hardware_concurrency());
+                size_t per = (h.count + threads - 1) / threads;
+                std::atomic<bool> bad(false);
+                auto decode = [&](size_t from, size_t to)
+                {
+                    for (size_t i = from; i < to; ++i)
+                    {
+                        // 旧版本的记录是新记录的前缀，缺的字段为0
+                        Record r = Record();
+                        memcpy(&r, records + i * record_size, record_size);
+                        if (r.url_off + r.url_len > h.heap_size || r.path_off + r.path_len > h.heap_size)
+                        {
+                            bad = true;
+                            return;
+                        }
+                        StorageInfo &e = (*arr)[i];
+                        e.mtime_ = r.mtime;
+                        e.atime_ = r.atime;
+                        e.fsize_ = r.fsize;
+                        e.hash_ = r.hash;
+                        e.url_.assign(heap + r.url_off, r.url_len);
+                        e.storage_path_.assign(heap + r.path_off, r.path_len);
+                    }
+                };
+                std::vector<std::thread> workers;
+                for (size_t from = per; from < h.count; from += per)
+                    workers.emplace_back(decode, from, std::min<size_t>(from + per, h.count));
+                decode(0, std::min<size_t>(per, h.count));
+                for (auto &t : workers)
+                    t.join();
+                ok = !bad;
+            }
+            munmap(addr, size);
+            if (!ok)
+            {
+                arr->clear();
+                mylog::GetLogger("asynclogger")->Warn("snapshot %s is corrupted", path.c_str());
+            }
+            return ok;
+        }
+
+    private:
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t count;
+            uint64_t heap_offset; // 字符串堆在文件中的偏移
+            uint64_t heap_size;
+        };
+        struct Record
+        {
+            int64_t mtime;
+            int64_t atime;
+            uint64_t fsize;
+            uint64_t url_off; // 相对字符串堆起点
+            uint64_t path_off;
+            uint32_t url_len;
+            uint32_t path_len;
+            uint64_t hash; // 版本2新增
+        };
+        static constexpr size_t kRecordSizeV1 = 48;
+        static_assert(sizeof(Header) == 32 && sizeof(Record) == 56, "snapshot layout");
+
+        // 攒满1MB再write，避免千万条记录各写一次
+        class Writer
+        {
+        public:
+            explicit Writer(int fd) : fd_(fd) { buf_.reserve(kBufSize); }
+            void Add(const void *data, size_t len) {
+                if (buf_.size() + len > kBufSize)
+                    Drain();
+                buf_.append(static_cast<const char *>(data), len);
+            }
+            bool Flush() {
+                Drain();
+                return good_;
+            }
+
+        private:
+            static constexpr size_t kBufSize = 1024 * 1024;
+            void Drain() {
+                size_t off = 0;
+                while (good_ && off < buf_.size())
+                {
+                    ssize_t n = write(fd_, buf_.data() + off, buf_.size() - off);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    good_ = n > 0;
+                    off += good_ ? n : 0;
+                }
+                buf_.clear();
+            }
+            int fd_;
+            bool good_ = true;
+            std::string buf_;
+        };
+    };
+}
@@ -0,0 +1,292 @@
+/* ************************************************************************
+> File Name:     SnapshotBench.cpp
+> Description:   元数据快照启动加载基准测试
+>                生成N条文件信息，分别写成二进制快照和JSON快照，
+>                统计写入、加载(含建哈希表)耗时和文件大小，结果以JSON输出。
+>                二进制快照还按DataManager启动时的做法分64个分片建CompactTable，
+>                --build-threads 1即原来单线程逐条建表的耗时
+> Usage:         ./snapshot_bench [--count 1000000,10000000] [--threads N]
+>                                 [--build-threads N] [--no-json] [--dir ./] [--out result.json]
+ ************************************************************************/
+#include "Snapshot.hpp"
+#include "CompactTable.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+    using Table = std::unordered_map<std::string, storage::StorageInfo>;
+
+    struct Options {
+        std::vector<size_t> counts = {1000000};
+        unsigned threads = 0;  // 二进制快照的解码线程数，0表示按CPU核数
+        unsigned build_threads = 0; // 分片建表的线程数，0表示按CPU核数
+        bool json = true;      // 千万级时JSON加载很慢，可以关掉只测二进制
+        std::string dir = "./";
+        std::string out;       // 为空则输出到标准输出
+    };
+
+    struct Result {
+        double write_secs;
+        double load_secs;  // 读文件并解码成StorageInfo
+        double build_secs; // 建哈希表
+        double shard_secs = 0; // 分片建CompactTable(含有序索引)，只有二进制快照测
+        uint64_t file_bytes;
+    };
+
+    static std::vector<size_t> SplitNum(const std::string &s) {
+        std::vector<size_t> ret;
+        std::stringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            if (!item.empty())
+                ret.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        return ret;
+    }
+
+    static bool ParseArgs(int argc, char *argv[], Options *opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--no-json") {
+                opt->json = false;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << std::endl;
+                return false;
+            }
+            std::string val = argv[++i];
+            if (arg == "--count")
+                opt->counts = SplitNum(val);
+            else if (arg == "--threads")
+                opt->threads = std::strtoul(val.c_str(), nullptr, 10);
+            else if (arg == "--build-threads")
+                opt->build_threads = std::strtoul(val.c_str(), nullptr, 10);
+            else if (arg == "--dir")
+                opt->dir = val;
+            else if (arg == "--out")
+                opt->out = val;
+            else {
+                std::cerr << "unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static double Secs(Clock::time_point from) {
+        return std::chrono::duration<double>(Clock::now() - from).count();
+    }
+
+    // 路径和URL的长度接近真实上传文件
+    static std::vector<storage::StorageInfo> Generate(size_t n) {
+        std::vector<storage::StorageInfo> arr(n);
+        for (size_t i = 0; i < n; ++i) {
+            std::string name = "file_" + std::to_string(i * 2654435761ULL % 1000000007ULL) + "_" + std::to_string(i) + ".dat";
+            arr[i].mtime_ = 1700000000 + i;
+            arr[i].atime_ = 1700000000 + i;
+            arr[i].fsize_ = i * 37 % (64 * 1024 * 1024);
+            arr[i].storage_path_ = (i % 2 ? "./deep_storage/" : "./low_storage/") + name;
+            arr[i].url_ = "/download/" + name;
+        }
+        return arr;
+    }
+
+    static double Build(std::vector<storage::StorageInfo> *arr, size_t expect) {
+        auto start = Clock::now();
+        Table table;
+        table.reserve(arr->size());
+        for (auto &e : *arr) {
+            std::string key = e.url_;
+            table[std::move(key)] = std::move(e);
+        }
+        double secs = Secs(start);
+        if (table.size() != expect)
+            std::cerr << "table size mismatch: " << table.size() << " != " << expect << std::endl;
+        return secs;
+    }
+
+    // 和DataManager::BuildShards一致：按文件名分组，几个线程各自取分片建表，再建有序索引
+    static double BuildShards(const std::vector<storage::StorageInfo> &arr, unsigned threads, size_t expect) {
+        constexpr size_t kShards = 64;
+        auto start = Clock::now();
+        std::vector<storage::CompactTable> tables(kShards);
+        std::vector<std::vector<uint32_t>> groups(kShards);
+        for (size_t i = 0; i < arr.size(); ++i) {
+            const std::string &url = arr[i].url_;
+            std::string_view name(url);
+            name.remove_prefix(url.find_last_of('/') + 1);
+            groups[std::hash<std::string_view>()(name) % kShards].push_back(i);
+        }
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        std::atomic<size_t> next(0);
+        auto run = [&]() {
+            for (size_t i = next++; i < kShards; i = next++) {
+                tables[i].Reserve(groups[i].size());
+                for (uint32_t idx : groups[i])
+                    tables[i].Put(arr[idx]);
+                tables[i].BuildOrders();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < std::min<size_t>(threads, kShards); ++t)
+            workers.emplace_back(run);
+        run();
+        for (auto &t : workers)
+            t.join();
+        double secs = Secs(start);
+        size_t total = 0;
+        for (auto &t : tables)
+            total += t.Size();
+        if (total != expect)
+            std::cerr << "shard size mismatch: " << total << " != " << expect << std::endl;
+        return secs;
+    }
+
+    static bool RunBinary(size_t n, const Options &opt, Result *r) {
+        std::string path = opt.dir + "snapshot_bench.bin";
+        std::vector<storage::StorageInfo> arr = Generate(n);
+        auto start = Clock::now();
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || !storage::Snapshot::Write(fd, arr) || fsync(fd) != 0)
+            return false;
+        close(fd);
+        r->write_secs = Secs(start);
+        r->file_bytes = storage::FileUtil(path).FileSize();
+        // 加载前释放源数据，千万级时内存只需容纳一份表
+        std::vector<storage::StorageInfo>().swap(arr);
+
+        std::vector<storage::StorageInfo> loaded;
+        start = Clock::now();
+        if (!storage::Snapshot::Load(path, &loaded, opt.threads) || loaded.size() != n)
+            return false;
+        r->load_secs = Secs(start);
+        r->shard_secs = BuildShards(loaded, opt.build_threads, n);
+        r->build_secs = Build(&loaded, n);
+        unlink(path.c_str());
+        return true;
+    }
+
+    // 和原来DataManager的做法一致：整表转成Json::Value数组再序列化
+    static bool RunJson(size_t n, const Options &opt, Result *r) {
+        std::string path = opt.dir + "snapshot_bench.json";
+        r->shard_secs = 0;
+        Clock::time_point start;
+        {
+            std::vector<storage::StorageInfo> arr = Generate(n);
+            start = Clock::now();
+            Json::Value root;
+            for (auto &e : arr) {
+                Json::Value item;
+                item["mtime_"] = (Json::Int64)e.mtime_;
+                item["atime_"] = (Json::Int64)e.atime_;
+                item["fsize_"] = (Json::Int64)e.fsize_;
+                item["url_"] = e.url_.c_str();
+                item["storage_path_"] = e.storage_path_.c_str();
+                root.append(item);
+            }
+            std::string body;
+            storage::JsonUtil::Serialize(root, &body);
+            if (!storage::FileUtil(path).SetContent(body.c_str(), body.size()))
+                return false;
+        }
+        r->write_secs = Secs(start);
+        r->file_bytes = storage::FileUtil(path).FileSize();
+
+        std::vector<storage::StorageInfo> loaded;
+        start = Clock::now();
+        {
+            std::string body;
+            Json::Value root;
+            if (!storage::FileUtil(path).GetContent(&body) || !storage::JsonUtil::UnSerialize(body, &root))
+                return false;
+            loaded.reserve(root.size());
+            for (int i = 0; i < (int)root.size(); ++i) {
+                storage::StorageInfo info;
+                info.fsize_ = root[i]["fsize_"].asInt64();
+                info.atime_ = root[i]["atime_"].asInt64();
+                info.mtime_ = root[i]["mtime_"].asInt64();
+                info.storage_path_ = root[i]["storage_path_"].asString();
+                info.url_ = root[i]["url_"].asString();
+                loaded.emplace_back(std::move(info));
+            }
+        }
+        r->load_secs = Secs(start);
+        r->build_secs = Build(&loaded, n);
+        unlink(path.c_str());
+        return true;
+    }
+
+    static Json::Value ToJson(const Result &r) {
+        Json::Value item;
+        item["write_secs"] = r.write_secs;
+        item["load_secs"] = r.load_secs;
+        item["build_secs"] = r.build_secs;
+        item["startup_secs"] = r.load_secs + r.build_secs;
+        item["file_bytes"] = (Json::UInt64)r.file_bytes;
+        if (r.shard_secs > 0) {
+            item["shard_build_secs"] = r.shard_secs;
+            item["shard_startup_secs"] = r.load_secs + r.shard_secs;
+        }
+        return item;
+    }
+} // namespace bench
+
+int main(int argc, char *argv[]) {
+    bench::Options opt;
+    if (!bench::ParseArgs(argc, argv, &opt))
+        return 1;
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    tp = new ThreadPool(g_conf_data->thread_count);
+    std::shared_ptr<mylog::LoggerBuilder> Glb(new mylog::LoggerBuilder());
+    Glb->BuildLoggerName("asynclogger");
+    Glb->BuildLoggerFlush<mylog::RollFileFlush>("./logfile/RollFile_log", 1024 * 1024);
+    mylog::LoggerManager::GetInstance().AddLogger(Glb->Build());
+
+    Json::Value root;
+    root["threads"] = opt.threads ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+    root["build_threads"] = opt.build_threads ? opt.build_threads : std::max(1u, std::thread::hardware_concurrency());
+    Json::Value &runs = root["runs"];
+    runs = Json::Value(Json::arrayValue);
+    int ret = 0;
+    for (size_t n : opt.counts) {
+        Json::Value item;
+        item["count"] = (Json::UInt64)n;
+        bench::Result r;
+        if (bench::RunBinary(n, opt, &r))
+            item["binary"] = bench::ToJson(r);
+        else {
+            std::cerr << "binary snapshot failed, count=" << n << std::endl;
+            ret = 1;
+        }
+        if (opt.json) {
+            if (bench::RunJson(n, opt, &r))
+                item["json"] = bench::ToJson(r);
+            else {
+                std::cerr << "json snapshot failed, count=" << n << std::endl;
+                ret = 1;
+            }
+        }
+        runs.append(item);
+        std::cerr << "done count=" << n << std::endl;
+    }
+
+    std::string body;
+    storage::JsonUtil::Serialize(root, &body);
+    if (opt.out.empty()) {
+        std::cout << body << std::endl;
+    } else {
+        std::ofstream ofs(opt.out);
+        ofs << body << std::endl;
+    }
+    delete (tp);
+    return ret;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "Config.hpp"
+#include "ContentHash.hpp"
+
+namespace storage
+{
+    // 用作初始化存储文件的属性信息
+    typedef struct StorageInfo{                   
+        time_t mtime_;
+        time_t atime_;
+        size_t fsize_;
+        uint64_t hash_ = 0;        // 原始内容的ContentHash，0表示未知(旧版本上传的文件)
+        std::string storage_path_; // 文件存储路径
+        std::string url_;          // 请求URL中的资源路径
+
+        bool NewStorageInfo(const std::string &storage_path) {
+            // 初始化备份文件的信息
+            mylog::GetLogger("asynclogger")->Info("NewStorageInfo start");
+            FileUtil f(storage_path);
+            if (!f.Exists())
+            {
+                mylog::GetLogger("asynclogger")->Info("file not exists");
+                return false;
+            }
+            mtime_ = f.LastModifyTime();
+            atime_ = f.LastAccessTime();
+            fsize_ = f.FileSize();
+            storage_path_ = storage_path;
+            // URL实际就是用户下载文件请求的路径
+            // 下载路径前缀+文件名
+            storage::Config *config = storage::Config::GetInstance();
+            url_ = config->GetDownloadPrefix() + f.FileName();
+            mylog::GetLogger("asynclogger")->Info("download_url:%s,mtime_:%s,atime_:%s,fsize_:%d", url_.c_str(),ctime(&mtime_),ctime(&atime_),fsize_);
+            mylog::GetLogger("asynclogger")->Info("NewStorageInfo end");
+            return true;
+        }
+    } StorageInfo; // namespace StorageInfo
+}
@@ -0,0 +1,240 @@
+/* ************************************************************************
+> File Name:     TableBench.cpp
+> Description:   元数据表内存占用基准测试
+>                分别用std::unordered_map<std::string, StorageInfo>和CompactTable
+>                存放N条文件信息，按malloc实际分配的字节统计每条占用的内存，
+>                并测随机按URL/按路径查找的耗时，结果以JSON输出。
+>                CompactTable的内存包括文件列表用的三个有序索引，按启动加载的方式建好后再统计；
+>                再以count作为一个分片的大小，测有序索引建好之后单条Put/Erase的耗时
+> Usage:         ./table_bench [--count 1000000,10000000] [--lookups N] [--ops N] [--out result.json]
+ ************************************************************************/
+#include "CompactTable.hpp"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+ThreadPool *tp = nullptr;
+mylog::Util::JsonData *g_conf_data;
+
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::vector<size_t> counts = {1000000};
+        size_t lookups = 1000000;
+        size_t ops = 100000; // 测单条Put/Erase耗时的次数
+        std::string out; // 为空则输出到标准输出
+    };
+
+    struct Result {
+        double build_secs;
+        double bytes_per_entry;
+        double url_lookup_ns;
+        double path_lookup_ns;
+    };
+
+    static std::vector<size_t> SplitNum(const std::string &s) {
+        std::vector<size_t> ret;
+        std::stringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            if (!item.empty())
+                ret.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        return ret;
+    }
+
+    static bool ParseArgs(int argc, char *argv[], Options *opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << std::endl;
+                return false;
+            }
+            std::string val = argv[++i];
+            if (arg == "--count")
+                opt->counts = SplitNum(val);
+            else if (arg == "--lookups")
+                opt->lookups = std::strtoull(val.c_str(), nullptr, 10);
+            else if (arg == "--ops")
+                opt->ops = std::strtoull(val.c_str(), nullptr, 10);
+            else if (arg == "--out")
+                opt->out = val;
+            else {
+                std::cerr << "unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static double Secs(Clock::time_point from) {
+        return std::chrono::duration<double>(Clock::now() - from).count();
+    }
+
+    // 当前由malloc分配出去的字节数
+    static size_t Allocated() {
+        return mallinfo2().uordblks + mallinfo2().hblkhd;
+    }
+
+    // 和上传生成的条目一致：URL是download_prefix+文件名，路径是存储目录+文件名
+    static storage::StorageInfo Make(size_t i) {
+        storage::StorageInfo e;
+        std::string name = "file_" + std::to_string(i * 2654435761ULL % 1000000007ULL) + "_" + std::to_string(i) + ".dat";
+        e.mtime_ = 1700000000 + i;
+        e.atime_ = 1700000000 + i;
+        e.fsize_ = i * 37 % (64 * 1024 * 1024);
+        e.storage_path_ = (i % 2 ? "./deep_storage/" : "./low_storage/") + name;
+        e.url_ = "/download/" + name;
+        return e;
+    }
+
+    // 查找用的key提前生成好，不计入查找耗时
+    static std::vector<size_t> Picks(size_t n, size_t lookups) {
+        std::mt19937_64 rng(42);
+        std::vector<size_t> ret(lookups);
+        for (auto &e : ret)
+            e = rng() % n;
+        return ret;
+    }
+
+    // finish在全部放入之后调用，计入建表时间和内存
+    template <typename Put, typename Finish, typename Get>
+    static Result Run(size_t n, const std::vector<size_t> &picks, Put put, Finish finish, Get get) {
+        Result r;
+        size_t before = Allocated();
+        auto start = Clock::now();
+        for (size_t i = 0; i < n; ++i)
+            put(Make(i));
+        finish();
+        r.build_secs = Secs(start);
+        r.bytes_per_entry = double(Allocated() - before) / n;
+
+        std::vector<storage::StorageInfo> keys;
+        keys.reserve(picks.size());
+        for (size_t i : picks)
+            keys.push_back(Make(i));
+        for (int by_path = 0; by_path < 2; ++by_path) {
+            size_t found = 0;
+            storage::StorageInfo info;
+            start = Clock::now();
+            for (auto &k : keys)
+                found += get(k, by_path, &info);
+            double ns = Secs(start) * 1e9 / keys.size();
+            (by_path ? r.path_lookup_ns : r.url_lookup_ns) = ns;
+            if (found != keys.size())
+                std::cerr << "lookup missed " << keys.size() - found << std::endl;
+        }
+        return r;
+    }
+
+    // 逐次计时，返回平均和p99，纳秒
+    template <typename Op>
+    static Json::Value Latency(size_t ops, Op op) {
+        std::vector<double> ns(ops);
+        for (size_t i = 0; i < ops; ++i)
+        {
+            auto start = Clock::now();
+            op(i);
+            ns[i] = Secs(start) * 1e9;
+        }
+        Json::Value item;
+        double sum = 0;
+        for (double v : ns)
+            sum += v;
+        std::sort(ns.begin(), ns.end());
+        item["avg_ns"] = ops ? sum / ops : 0;
+        item["p99_ns"] = ops ? ns[ops * 99 / 100] : 0;
+        item["max_ns"] = ops ? ns.back() : 0;
+        return item;
+    }
+
+    static Json::Value ToJson(const Result &r) {
+        Json::Value item;
+        item["build_secs"] = r.build_secs;
+        item["bytes_per_entry"] = r.bytes_per_entry;
+        item["url_lookup_ns"] = r.url_lookup_ns;
+        item["path_lookup_ns"] = r.path_lookup_ns;
+        return item;
+    }
+} // namespace bench
+
+int main(int argc, char *argv[]) {
+    bench::Options opt;
+    if (!bench::ParseArgs(argc, argv, &opt))
+        return 1;
+    g_conf_data = mylog::Util::JsonData::GetJsonData();
+    tp = new ThreadPool(g_conf_data->thread_count);
+
+    Json::Value root;
+    Json::Value &runs = root["runs"];
+    runs = Json::Value(Json::arrayValue);
+    for (size_t n : opt.counts) {
+        std::vector<size_t> picks = bench::Picks(n, opt.lookups);
+        Json::Value item;
+        item["count"] = (Json::UInt64)n;
+        {
+            // 原来DataManager的表：URL作key，按路径查找只能遍历，这里另建一个路径到URL的索引
+            std::unordered_map<std::string, storage::StorageInfo> table;
+            std::unordered_map<std::string, std::string> paths;
+            bench::Result r = bench::Run(
+                n, picks,
+                [&](storage::StorageInfo e) {
+                    paths[e.storage_path_] = e.url_;
+                    std::string key = e.url_;
+                    table[std::move(key)] = std::move(e);
+                },
+                [] {},
+                [&](const storage::StorageInfo &k, int by_path, storage::StorageInfo *info) {
+                    auto it = table.find(by_path ? paths[k.storage_path_] : k.url_);
+                    if (it == table.end())
+                        return false;
+                    *info = it->second;
+                    return true;
+                });
+            item["unordered_map"] = bench::ToJson(r);
+        }
+        malloc_trim(0);
+        {
+            storage::CompactTable table;
+            bench::Result r = bench::Run(
+                n, picks,
+                [&](const storage::StorageInfo &e) { table.Put(e); },
+                [&] { table.BuildOrders(); },
+                [&](const storage::StorageInfo &k, int by_path, storage::StorageInfo *info) {
+                    return by_path ? table.GetByPath(k.storage_path_, info) : table.Get(k.url_, info);
+                });
+            item["compact"] = bench::ToJson(r);
+            item["compact"]["table_bytes_per_entry"] = double(table.MemoryBytes()) / n;
+            // 有序索引建好之后，一个有n条的分片上每次上传/删除在写锁内的耗时
+            std::vector<storage::StorageInfo> extra;
+            extra.reserve(opt.ops);
+            for (size_t i = 0; i < opt.ops; ++i)
+                extra.push_back(bench::Make(n + i));
+            item["compact"]["put"] = bench::Latency(opt.ops, [&](size_t i)
+                                                    { table.Put(extra[i]); });
+            item["compact"]["erase"] = bench::Latency(opt.ops, [&](size_t i)
+                                                      { table.Erase(extra[i].url_, nullptr); });
+        }
+        malloc_trim(0);
+        runs.append(item);
+        std::cerr << "done count=" << n << std::endl;
+    }
+
+    std::string body;
+    storage::JsonUtil::Serialize(root, &body);
+    if (opt.out.empty()) {
+        std::cout << body << std::endl;
+    } else {
+        std::ofstream ofs(opt.out);
+        ofs << body << std::endl;
+    }
+    delete (tp);
+    return 0;
+}
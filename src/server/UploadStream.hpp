@@ -0,0 +1,597 @@
+#pragma once
+#include "BlobStore.hpp"
+#include "BlockCompressor.hpp"
+#include "Config.hpp"
+#include "ContentHash.hpp"
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 流式上传：libevent 2.1的evhttp只能在请求体全部读入内存后才回调，
+// 这里在每个连接的socket bufferevent上套一层过滤器，识别出/upload请求后
+// 把请求体边收边写进目标目录下的临时文件，只把请求头交给evhttp。
+// 请求体按块交给BlockWriter在后台写入(deep同时压缩)，事件循环不做磁盘写入，积压过多时暂停读socket；
+// 全部块写完后才放行请求头(Content-Length改为0，并带上X-Upload-Id)。
+// 临时文件等结果记在本连接的对象里，Service::Upload用Take按编号取走，不信任请求头中的路径。
+// 每个连接占用的内存不超过upload_buffer_size加上积压的块，与文件大小无关
+namespace storage
+{
+    class UploadStream
+    {
+    public:
+        // 内部使用的请求头，客户端发来的同名头一律去掉
+        static constexpr const char *kIdHeader = "X-Upload-Id";
+
+        // 一个已经收完的流式上传
+        struct Finished
+        {
+            uint64_t id = 0;
+            std::string temp_path; // 为空表示服务端写入失败
+            std::string storage_type;
+            uint64_t size = 0;
+            uint64_t hash = 0;     // 边收边算的内容哈希
+        };
+
+        // 传给evhttp_set_bevcb，arg为压缩和写入请求体的工作线程池；evhttp随后会对返回的bufferevent调用setfd
+        static bufferevent *NewConnection(event_base *base, void *arg) {
+            size_t limit = Config::GetInstance()->GetUploadBufferSize();
+            bufferevent *underlying = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+            if (underlying == nullptr)
+                return nullptr;
+            // 底层输入缓冲区最多积累limit字节，超过后暂停读socket
+            bufferevent_setwatermark(underlying, EV_READ, 0, limit);
+            bufferevent_set_max_single_read(underlying, limit);
+            // 底层输出缓冲区超过limit后过滤器不再往下搬数据，流式响应据此感知慢客户端
+            bufferevent_setwatermark(underlying, EV_WRITE, 0, limit);
+            // 过滤器不会替底层打开读事件，setfd时按这里的enabled重新注册
+            bufferevent_enable(underlying, EV_READ | EV_WRITE);
+            UploadStream *self = new UploadStream(underlying, static_cast<WorkStealingPool *>(arg));
+            bufferevent *bev = bufferevent_filter_new(underlying, FilterIn, NULL, BEV_OPT_CLOSE_ON_FREE,
+                                                      FreeContext, self);
+            if (bev == nullptr)
+            {
+                delete self;
+                bufferevent_free(underlying);
+                return nullptr;
+            }
+            // libevent 2.1的过滤器在EV_WRITE关闭期间写入的数据，重新打开写事件后不会自动下发；
+            // evhttp正是先写响应头再打开写事件，这里在有数据写入时补一次flush
+            self->bev_ = bev;
+            self->flush_ev_ = event_new(base, -1, 0, FlushOutput, self);
+            self->resume_ev_ = event_new(base, -1, 0, Resume, self);
+            evbuffer_add_cb(bufferevent_get_output(bev), OutputAdded, self);
+            std::unique_lock<std::mutex> lock(RegistryMutex());
+            Registry()[bev] = self;
+            return bev;
+        }
+
+        // 在事件循环线程中调用：取走req所在连接上编号为id的上传结果，临时文件从此归调用方处理。
+        // 编号更小的是evhttp没有交给Upload的请求留下的，一并删除
+        static bool Take(evhttp_request *req, uint64_t id, Finished *out) {
+            evhttp_connection *evcon = evhttp_request_get_connection(req);
+            bufferevent *bev = evcon ? evhttp_connection_get_bufferevent(evcon) : nullptr;
+            std::unique_lock<std::mutex> lock(RegistryMutex());
+            auto it = Registry().find(bev);
+            if (it == Registry().end())
+                return false;
+            std::deque<Finished> &finished = it->second->finished_;
+            while (!finished.empty() && finished.front().id < id)
+            {
+                if (!finished.front().temp_path.empty())
+                    unlink(finished.front().temp_path.c_str());
+                finished.pop_front();
+            }
+            if (finished.empty() || finished.front().id != id)
+                return false;
+            *out = std::move(finished.front());
+            finished.pop_front();
+            return true;
+        }
+
+    private:
+        enum class State
+        {
+            HEADER, // 等待完整的请求头
+            BODY,   // 正在把请求体交给后台写入临时文件
+            PASS,   // 非上传请求的请求体，原样交给evhttp
+            CHUNK,  // chunked请求体，按块重新编码后交给evhttp，以便找到下一个请求头
+            WAIT,   // 请求体已收完，等待后台写完，期间收到的数据先不处理
+            BAD     // 请求无法解析(请求头过长、格式错误)，已让evhttp拒绝并断开，剩余数据丢弃
+        };
+        static constexpr size_t kMaxHeader = 64 * 1024;
+
+        // 以过滤层bufferevent为键，Take据此从evhttp的请求找到连接的上传结果
+        static std::unordered_map<bufferevent *, UploadStream *> &Registry() {
+            static std::unordered_map<bufferevent *, UploadStream *> registry;
+            return registry;
+        }
+        static std::mutex &RegistryMutex() {
+            static std::mutex mtx;
+            return mtx;
+        }
+
+        UploadStream(bufferevent *underlying, WorkStealingPool *pool) : underlying_(underlying), pool_(pool) {}
+        ~UploadStream() {
+            {
+                std::unique_lock<std::mutex> lock(RegistryMutex());
+                Registry().erase(bev_);
+            }
+            // 先让BlockWriter不再通知，再释放它要激活的事件；请求体没收完连接就断了，删掉残留的临时文件
+            if (writer_)
+            {
+                writer_->Abort();
+                unlink(temp_path_.c_str());
+            }
+            if (resume_ev_)
+                event_free(resume_ev_);
+            if (flush_ev_)
+                event_free(flush_ev_);
+            if (fd_ != -1)
+            {
+                close(fd_);
+                unlink(temp_path_.c_str());
+            }
+            // 已经收完但还没有被Upload取走的
+            for (auto &f : finished_)
+                if (!f.temp_path.empty())
+                    unlink(f.temp_path.c_str());
+        }
+        static void FreeContext(void *ctx) {
+            delete static_cast<UploadStream *>(ctx);
+        }
+
+        static void OutputAdded(evbuffer * /*buf*/, const evbuffer_cb_info *info, void *ctx) {
+            UploadStream *self = static_cast<UploadStream *>(ctx);
+            if (info->n_added > 0 && self->flush_ev_)
+                event_active(self->flush_ev_, 0, 0);
+        }
+        static void FlushOutput(evutil_socket_t, short, void *ctx) {
+            UploadStream *self = static_cast<UploadStream *>(ctx);
+            bufferevent_flush(self->bev_, EV_WRITE, BEV_NORMAL);
+            // 响应发完后evhttp重新打开读事件，这时处理它忙碌期间留在底层缓冲区中的后续请求
+            self->Kick();
+        }
+
+        // 后台写入积压减少或全部写完后，在事件循环线程中被激活
+        static void Resume(evutil_socket_t, short, void *ctx) {
+            UploadStream *self = static_cast<UploadStream *>(ctx);
+            if (!self->writer_)
+                return;
+            if (self->state_ == State::WAIT)
+            {
+                if (!self->writer_->Done())
+                    return;
+                self->FinishBody();
+            }
+            else if (self->writer_->Pending() >= BlockWriter::kMaxPending)
+                return;
+            if (self->paused_)
+            {
+                self->paused_ = false;
+                bufferevent_enable(self->underlying_, EV_READ);
+            }
+            // WAIT期间留在底层缓冲区中的后续请求
+            self->Kick();
+        }
+
+        // 过滤层的读事件关闭期间(evhttp正在处理上一个请求)，libevent不会处理底层缓冲区中已有的数据，
+        // 重新打开后也只在socket上有新数据时才继续，这里主动补一次
+        void Kick() {
+            if (evbuffer_get_length(bufferevent_get_input(underlying_)) > 0 && (bufferevent_get_enabled(bev_) & EV_READ))
+                bufferevent_trigger(underlying_, EV_READ, BEV_TRIG_IGNORE_WATERMARKS);
+        }
+
+        void Pause() {
+            if (paused_)
+                return;
+            paused_ = true;
+            bufferevent_disable(underlying_, EV_READ);
+        }
+
+        static bufferevent_filter_result FilterIn(evbuffer *src, evbuffer *dst, ev_ssize_t /*limit*/,
+                                                  bufferevent_flush_mode /*mode*/, void *ctx) {
+            UploadStream *self = static_cast<UploadStream *>(ctx);
+            bool progressed = false;
+            while (evbuffer_get_length(src) > 0)
+            {
+                if (self->state_ == State::WAIT)
+                    break;
+                if (self->state_ == State::BAD)
+                {
+                    evbuffer_drain(src, evbuffer_get_length(src));
+                    break;
+                }
+                if (self->state_ == State::PASS)
+                {
+                    size_t n = std::min<uint64_t>(evbuffer_get_length(src), self->remaining_);
+                    evbuffer_remove_buffer(src, dst, n);
+                    self->remaining_ -= n;
+                    if (self->remaining_ == 0)
+                        self->state_ = self->chunked_ ? State::CHUNK : State::HEADER;
+                    progressed = true;
+                    continue;
+                }
+                if (self->state_ == State::BODY)
+                {
+                    self->WriteBody(src);
+                    progressed = true;
+                    continue;
+                }
+                if (self->state_ == State::CHUNK)
+                {
+                    if (!self->ChunkLine(src, dst))
+                        break;
+                    progressed = true;
+                    continue;
+                }
+                size_t len = HeaderLength(src);
+                if (len == 0)
+                {
+                    if (TooLong(src))
+                    {
+                        self->Reject(dst);
+                        progressed = true;
+                    }
+                    break;
+                }
+                std::string head(len, '\0');
+                evbuffer_remove(src, &head[0], head.size());
+                self->ParseHeader(head, dst);
+                progressed = true;
+            }
+            return progressed ? BEV_OK : BEV_NEED_MORE;
+        }
+
+        static bool EqualsNoCase(const std::string &a, const char *b) {
+            size_t n = strlen(b);
+            if (a.size() != n)
+                return false;
+            for (size_t i = 0; i < n; ++i)
+                if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+                    return false;
+            return true;
+        }
+
+        // 请求头(到请求行之后的第一个空行为止)的长度。和evhttp一样LF或CRLF都算行尾，不完整时返回0
+        static size_t HeaderLength(evbuffer *src) {
+            evbuffer_ptr pos;
+            evbuffer_ptr_set(src, &pos, 0, EVBUFFER_PTR_SET);
+            for (bool first = true;; first = false)
+            {
+                size_t eol_len = 0;
+                evbuffer_ptr eol = evbuffer_search_eol(src, &pos, &eol_len, EVBUFFER_EOL_CRLF);
+                if (eol.pos < 0)
+                    return 0;
+                bool empty = eol.pos == pos.pos;
+                size_t end = eol.pos + eol_len;
+                if (empty && !first)
+                    return end;
+                if (end >= evbuffer_get_length(src))
+                    return 0;
+                evbuffer_ptr_set(src, &pos, end, EVBUFFER_PTR_SET);
+            }
+        }
+
+        // 从src取出一行(不含行尾)，没有完整的一行时返回false
+        static bool ReadLine(evbuffer *src, std::string *line) {
+            size_t eol_len = 0;
+            evbuffer_ptr eol = evbuffer_search_eol(src, NULL, &eol_len, EVBUFFER_EOL_CRLF);
+            if (eol.pos < 0)
+                return false;
+            line->assign(eol.pos, '\0');
+            evbuffer_remove(src, &(*line)[0], line->size());
+            evbuffer_drain(src, eol_len);
+            return true;
+        }
+
+        // 按evhttp的规则把请求头拆成(名字, 值)：续行并入上一个值，值去掉开头的空格和结尾的空白。
+        // 有evhttp会拒绝的行时返回false
+        static bool SplitHeaders(const std::string &head, std::string *request_line,
+                                 std::vector<std::pair<std::string, std::string>> *headers) {
+            std::vector<std::string> lines;
+            for (size_t pos = 0; pos < head.size();)
+            {
+                size_t eol = head.find('\n', pos);
+                std::string line = head.substr(pos, eol - pos);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                lines.push_back(line);
+                pos = eol + 1;
+            }
+            lines.pop_back(); // 结尾的空行
+            *request_line = lines[0];
+            for (size_t i = 1; i < lines.size(); ++i)
+            {
+                const std::string &line = lines[i];
+                if (line[0] == ' ' || line[0] == '\t')
+                {
+                    if (headers->empty())
+                        return false;
+                    size_t v = line.find_first_not_of(" \t");
+                    headers->back().second += " " + (v == std::string::npos ? "" : line.substr(v));
+                }
+                else
+                {
+                    size_t colon = line.find(':');
+                    if (colon == std::string::npos)
+                        return false;
+                    headers->emplace_back(line.substr(0, colon), line.substr(colon + 1));
+                }
+                // 重新拼接后evhttp还会再去掉一次首尾空白，这里先去掉，两边看到的值才相同
+                std::string &value = headers->back().second;
+                value.erase(0, value.find_first_not_of(' '));
+                value.erase(value.find_last_not_of(" \t") + 1);
+            }
+            return !request_line->empty();
+        }
+
+        // 解析一个完整请求头，决定流式写文件还是原样转交。转交给evhttp的请求头按拆分结果重新拼接，
+        // 过滤器和evhttp对请求体在哪里结束的判断因此一致，每个请求中的内部请求头都能去掉
+        void ParseHeader(const std::string &head, evbuffer *dst) {
+            std::string request_line;
+            std::vector<std::pair<std::string, std::string>> headers;
+            if (!SplitHeaders(head, &request_line, &headers))
+            {
+                Reject(dst);
+                return;
+            }
+            std::string kept = request_line + "\r\n";     // 原样转交时的请求头
+            std::string streamed = request_line + "\r\n"; // 流式上传时的请求头，不含Content-Length和Expect
+            const std::string *storage_type = nullptr;
+            const std::string *content_length = nullptr;
+            const std::string *transfer_encoding = nullptr;
+            bool expect_continue = false;
+            for (auto &h : headers)
+            {
+                const std::string &name = h.first;
+                if (EqualsNoCase(name, kIdHeader))
+                    continue;
+                std::string line = name + ": " + h.second + "\r\n";
+                kept += line;
+                // evhttp只看同名请求头中的第一个
+                if (EqualsNoCase(name, "Content-Length"))
+                {
+                    if (!content_length)
+                        content_length = &h.second;
+                    continue;
+                }
+                if (EqualsNoCase(name, "Expect"))
+                {
+                    expect_continue = true;
+                    continue;
+                }
+                if (EqualsNoCase(name, "Transfer-Encoding") && !transfer_encoding)
+                    transfer_encoding = &h.second;
+                else if (EqualsNoCase(name, "StorageType") && !storage_type)
+                    storage_type = &h.second;
+                streamed += line;
+            }
+            kept += "\r\n";
+
+            std::string method = request_line.substr(0, request_line.find(' '));
+            size_t uri_begin = request_line.find(' ') + 1;
+            std::string uri = request_line.substr(uri_begin, request_line.find(' ', uri_begin) - uri_begin);
+            std::string path = uri.substr(0, uri.find('?'));
+            // libevent 2.1中HEAD、TRACE和不认识的方法没有请求体
+            bool may_have_body = method == "GET" || method == "POST" || method == "PUT" || method == "DELETE" ||
+                                 method == "OPTIONS" || method == "CONNECT" || method == "PATCH";
+            chunked_ = may_have_body && transfer_encoding && EqualsNoCase(*transfer_encoding, "chunked");
+            int64_t length = 0;
+            if (may_have_body && !chunked_ && content_length)
+            {
+                char *end = nullptr;
+                length = strtoll(content_length->c_str(), &end, 10);
+                if (content_length->empty() || *end != '\0' || length < 0)
+                {
+                    Reject(dst);
+                    return;
+                }
+            }
+
+            std::string type = storage_type ? *storage_type : "";
+            if (!chunked_ && method == "POST" && path == "/upload" && length > 0 &&
+                (type == "low" || type == "deep") && OpenTemp(type))
+            {
+                header_ = streamed; // Content-Length放行时再补上
+                storage_type_ = type;
+                // fd交给BlockWriter，请求体按块在后台写入，deep同时压缩
+                int format = type == "deep" ? Config::GetInstance()->GetBundleFormat() : BlockWriter::kRaw;
+                writer_ = std::make_shared<BlockWriter>(fd_, format, pool_);
+                fd_ = -1;
+                event *ev = resume_ev_;
+                writer_->SetNotify([ev]()
+                                   { event_active(ev, 0, 0); });
+                block_size_ = Config::GetInstance()->GetDeepBlockSize();
+                block_.clear();
+                block_.reserve(block_size_);
+                remaining_ = length;
+                total_ = length;
+                hash_ = ContentHash();
+                state_ = State::BODY;
+                // 客户端在等100-continue，由过滤器直接回复
+                if (expect_continue)
+                    bufferevent_write(underlying_, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+                return;
+            }
+            evbuffer_add(dst, kept.data(), kept.size());
+            if (chunked_)
+            {
+                trailer_ = false;
+                state_ = State::CHUNK;
+            }
+            else if (length > 0)
+            {
+                remaining_ = length;
+                state_ = State::PASS;
+            }
+        }
+
+        // chunked请求体中的一行：块大小或结尾的trailer。和evhttp一样跳过空行、用strtoll解析块大小，
+        // 块数据交给PASS状态原样转交，trailer中可能带内部请求头，整个丢掉。行不完整时返回false
+        bool ChunkLine(evbuffer *src, evbuffer *dst) {
+            std::string line;
+            if (!ReadLine(src, &line))
+            {
+                if (!TooLong(src))
+                    return false;
+                Reject(dst);
+                return true;
+            }
+            if (trailer_)
+            {
+                if (line.empty())
+                {
+                    evbuffer_add(dst, "\r\n", 2);
+                    chunked_ = false;
+                    state_ = State::HEADER;
+                }
+                return true;
+            }
+            if (line.empty())
+                return true;
+            char *end = nullptr;
+            long long size = strtoll(line.c_str(), &end, 16);
+            if ((*end != '\0' && *end != ' ') || size < 0)
+            {
+                Reject(dst);
+                return true;
+            }
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%llx\r\n", size);
+            evbuffer_add(dst, buf, n);
+            if (size == 0)
+            {
+                trailer_ = true;
+                return true;
+            }
+            // 块数据原样转交，之后的CRLF和evhttp一样当作空行跳过
+            remaining_ = size;
+            state_ = State::PASS;
+            return true;
+        }
+
+        // 缓存的数据里还没有完整的一行。底层缓冲区最多只有upload_buffer_size字节，上限不能比它大
+        static bool TooLong(evbuffer *src) {
+            return evbuffer_get_length(src) >= std::min(kMaxHeader, Config::GetInstance()->GetUploadBufferSize());
+        }
+
+        // 交给evhttp一个无法解析的行(作为请求行或块大小都不合法)，由它回复错误并断开连接
+        void Reject(evbuffer *dst) {
+            state_ = State::BAD;
+            evbuffer_add(dst, "invalid\r\n\r\n", 11);
+        }
+
+        bool OpenTemp(const std::string &storage_type) {
+            std::string dir = storage_type == "low" ? Config::GetInstance()->GetLowStorageDir()
+                                                    : Config::GetInstance()->GetDeepStorageDir();
+            FileUtil(dir).CreateDirectory();
+            std::string tmpl = dir + BlobStore::kTempPrefix + "XXXXXX";
+            fd_ = mkstemp(&tmpl[0]);
+            if (fd_ == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("mkstemp %s err: %s", tmpl.c_str(), strerror(errno));
+                return false;
+            }
+            fchmod(fd_, 0644); // mkstemp默认0600，与普通写入的文件保持一致
+            temp_path_ = tmpl;
+            return true;
+        }
+
+        // 把src中属于请求体的部分攒满一块交给BlockWriter，积压过多时暂停读socket
+        void WriteBody(evbuffer *src) {
+            size_t n = std::min<uint64_t>(evbuffer_get_length(src), remaining_);
+            remaining_ -= n;
+            while (n > 0)
+            {
+                size_t take = std::min(n, block_size_ - block_.size());
+                size_t old = block_.size();
+                block_.resize(old + take);
+                evbuffer_remove(src, &block_[old], take);
+                hash_.Update(&block_[old], take);
+                n -= take;
+                if (block_.size() < block_size_)
+                    continue;
+                if (!writer_->Submit(std::move(block_)))
+                    Pause();
+                block_ = std::string();
+                block_.reserve(block_size_);
+            }
+            if (remaining_ > 0)
+                return;
+            if (!block_.empty())
+                writer_->Submit(std::move(block_));
+            block_ = std::string();
+            writer_->Finish();
+            state_ = State::WAIT;
+            Pause();
+        }
+
+        // 后台全部写完，放行暂存的请求头
+        void FinishBody() {
+            bool ok = !writer_->Failed();
+            writer_.reset();
+            if (!ok)
+                unlink(temp_path_.c_str());
+            ReleaseHeader(bufferevent_get_input(bev_), ok);
+            // evhttp还在处理前一个请求时不能打断它，它处理完后会自己读缓冲区中的请求头
+            if (bufferevent_get_enabled(bev_) & EV_READ)
+                bufferevent_trigger(bev_, EV_READ, BEV_TRIG_IGNORE_WATERMARKS);
+        }
+
+        // 结果记入finished_，请求头只带上编号交给evhttp；ok为false表示服务端写入失败
+        void ReleaseHeader(evbuffer *dst, bool ok) {
+            Finished f;
+            f.id = ++next_id_;
+            f.temp_path = ok ? temp_path_ : "";
+            f.storage_type = storage_type_;
+            f.size = total_;
+            f.hash = hash_.Final();
+            {
+                std::unique_lock<std::mutex> lock(RegistryMutex());
+                finished_.push_back(std::move(f));
+            }
+            header_ += std::string(kIdHeader) + ": " + std::to_string(next_id_) + "\r\n";
+            header_ += "Content-Length: 0\r\n\r\n";
+            evbuffer_add(dst, header_.data(), header_.size());
+            header_.clear();
+            temp_path_.clear();
+            state_ = State::HEADER;
+        }
+
+    private:
+        bufferevent *underlying_;
+        WorkStealingPool *pool_;
+        bufferevent *bev_ = nullptr;    // 交给evhttp的过滤层
+        event *flush_ev_ = nullptr;
+        event *resume_ev_ = nullptr;    // BlockWriter从后台线程激活
+        BlockWriter::ptr writer_;       // 正在进行的上传
+        std::string block_;             // 尚未攒满的块
+        size_t block_size_ = 0;
+        bool paused_ = false;           // 是否暂停了读socket
+        State state_ = State::HEADER;
+        uint64_t remaining_ = 0; // 当前请求体(chunked时为当前块)还剩多少字节
+        bool chunked_ = false;   // 当前请求体是chunked编码
+        bool trailer_ = false;   // chunked请求体已到最后一块，正在读trailer
+        uint64_t total_ = 0;
+        ContentHash hash_;       // 当前请求体的内容哈希
+        std::string header_;     // 流式上传时暂存的请求头
+        std::string temp_path_;
+        std::string storage_type_;
+        int fd_ = -1;
+        uint64_t next_id_ = 0;
+        std::deque<Finished> finished_; // 等待Upload取走的结果，由RegistryMutex保护
+    };
+}
@@ -8,9 +8,11 @@
 #include <iostream>
 #include <experimental/filesystem>
 #include <string>
+#include <cstring>
 #include <sys/stat.h>
 #include <vector>
 #include <fstream>
+#include <iterator>
 #include "../../log_system/logs_code/MyLog.hpp"
 
 namespace storage
@@ -182,7 +184,92 @@ namespace storage
             }
             return true;
         }
+        // 深度存储的分块格式：kBlockMagic后跟若干块，每块为4字节压缩长度+bundle::pack的输出，
+        // 之后是长度为0的结束标记、每块一个BlockIndexEntry，最后是8字节索引偏移+4字节块数+kBlockIndexMagic。
+        // 上传时边收边压缩(见BlockCompressor.hpp)，没有索引的分块文件和旧的整体压缩文件仍可解压
+        static constexpr const char *kBlockMagic = "DSB1";
+        static constexpr const char *kBlockIndexMagic = "DSBX";
+        static constexpr size_t kBlockMagicLen = 4;
+        struct __attribute__((packed)) BlockIndexEntry
+        {
+            uint64_t offset;  // 块(含4字节长度)在文件中的偏移
+            uint32_t raw_len; // 解压后的长度
+        };
+        bool IsBlockFile() {
+            char magic[kBlockMagicLen];
+            std::ifstream ifs(filename_.c_str(), std::ios::binary);
+            return ifs.read(magic, kBlockMagicLen) && memcmp(magic, kBlockMagic, kBlockMagicLen) == 0;
+        }
+        // 逐块解压到download_path，内存中只保留一个块
+        bool UnCompressBlocks(const std::string &download_path) {
+            std::ifstream ifs(filename_.c_str(), std::ios::binary);
+            std::ofstream ofs(download_path.c_str(), std::ios::binary);
+            if (!ifs.is_open() || !ofs.is_open())
+            {
+                mylog::GetLogger("asynclogger")->Info("filename:%s, uncompress open failed!", filename_.c_str());
+                return false;
+            }
+            ifs.seekg(kBlockMagicLen);
+            std::string packed;
+            uint32_t len;
+            bool terminated = false;
+            uint64_t blocks = 0, raw_size = 0;
+            while (ifs.read((char *)&len, sizeof(len)))
+            {
+                if (len == 0)
+                {
+                    terminated = true;
+                    break;
+                }
+                packed.resize(len);
+                if (!ifs.read(&packed[0], len))
+                    break;
+                std::string unpacked = bundle::unpack(packed);
+                ofs.write(unpacked.data(), unpacked.size());
+                ++blocks;
+                raw_size += unpacked.size();
+            }
+            // 没读到结束标记说明文件被截断了，不能把前面解出来的部分当成完整文件
+            if (!terminated)
+            {
+                mylog::GetLogger("asynclogger")->Info("filename:%s, truncated block file", filename_.c_str());
+                return false;
+            }
+            if (!CheckBlockIndex(ifs, blocks, raw_size))
+            {
+                mylog::GetLogger("asynclogger")->Info("filename:%s, block index mismatch", filename_.c_str());
+                return false;
+            }
+            return ofs.good();
+        }
+        // 结束标记之后是块索引和尾部，块数和解压后的总大小要和索引一致；
+        // 结束标记之后什么都没有的是没有索引的旧文件
+        static bool CheckBlockIndex(std::ifstream &ifs, uint64_t blocks, uint64_t raw_size) {
+            uint64_t index_offset = ifs.tellg();
+            std::string tail((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            if (tail.empty())
+                return true;
+            const size_t trailer = sizeof(uint64_t) + sizeof(uint32_t) + kBlockMagicLen;
+            if (tail.size() < trailer || tail.compare(tail.size() - kBlockMagicLen, kBlockMagicLen, kBlockIndexMagic) != 0)
+                return false;
+            uint64_t offset;
+            uint32_t count;
+            memcpy(&offset, &tail[tail.size() - trailer], sizeof(offset));
+            memcpy(&count, &tail[tail.size() - trailer + sizeof(offset)], sizeof(count));
+            if (offset != index_offset || count != blocks || tail.size() != count * sizeof(BlockIndexEntry) + trailer)
+                return false;
+            uint64_t total = 0;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                BlockIndexEntry e;
+                memcpy(&e, &tail[i * sizeof(BlockIndexEntry)], sizeof(e));
+                total += e.raw_len;
+            }
+            return total == raw_size;
+        }
         bool UnCompress(std::string &download_path) {
+            if (IsBlockFile())
+                return UnCompressBlocks(download_path);
             // 将当前压缩包数据读取出来
             std::string body;
             if (this->GetContent(&body) == false)
@@ -252,7 +339,7 @@ namespace storage
                 mylog::GetLogger("asynclogger")->Info("parse error");
                 return false;
             }
-            return false;
+            return true;
         }
     };
 }
\ No newline at end of file